@@ -0,0 +1,33 @@
+-- Stress scene for Mercury-bench, sized by the bench.foxes, bench.props and
+-- bench.scripted globals set on the command line
+
+local spacing = 8
+
+local function grid(count, y)
+    local side = math.ceil(math.sqrt(count))
+    local transforms = {}
+    for index = 0, count - 1 do
+        local t = Transform.new()
+        t.position.x = (index % side - side / 2) * spacing
+        t.position.y = y
+        t.position.z = (math.floor(index / side) - side / 2) * spacing
+        transforms[index + 1] = t
+    end
+    return transforms
+end
+
+spawn_many(assets.prefabs['fox'], bench.foxes, grid(bench.foxes, -30))
+spawn_many(assets.prefabs['fox_prop'], bench.props, grid(bench.props, -40))
+local scripted = spawn_many(assets.prefabs['fox_prop'], bench.scripted,
+                            grid(bench.scripted, -20))
+
+local elapsed = 0
+function bench_update(dt)
+    elapsed = elapsed + dt
+    for i, e in ipairs(scripted) do
+        local t = e:transform()
+        t.position.y = -20 + math.sin(elapsed + i)
+        t.rotation.y = math.sin((elapsed + i) / 2)
+        t.rotation.w = math.cos((elapsed + i) / 2)
+    end
+end
@@ -0,0 +1,248 @@
+#include "animation_import.h"
+#include "asset_library.h"
+#include "ozz/animation/offline/animation_builder.h"
+#include "ozz/animation/offline/animation_optimizer.h"
+#include "ozz/animation/offline/raw_animation.h"
+#include "ozz/animation/offline/raw_skeleton.h"
+#include "ozz/animation/offline/skeleton_builder.h"
+#include "ozz/animation/runtime/animation.h"
+#include "ozz/animation/runtime/skeleton.h"
+#include "ozz/base/io/archive.h"
+#include "ozz/base/io/stream.h"
+#include "log.h"
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+#undef assert_invariant
+#include <nlohmann/json.hpp>
+
+using ozz::animation::offline::RawAnimation;
+using ozz::animation::offline::RawSkeleton;
+
+ImportSettings parse_import_settings(std::span<const char> data) {
+    auto json = nlohmann::json::parse(data.begin(), data.end());
+    ImportSettings settings;
+    settings.source = json.at("source").get<std::string>();
+    settings.clip = json.value("clip", "");
+    settings.tolerance = json.value("tolerance", settings.tolerance);
+    settings.distance = json.value("distance", settings.distance);
+    for (auto& [name, joint] :
+         json.value("joints", nlohmann::json::object()).items())
+        settings.joints[name] = {
+            joint.value("tolerance", settings.tolerance),
+            joint.value("distance", settings.distance)};
+    return settings;
+}
+
+static ozz::math::Transform to_transform(const aiMatrix4x4& matrix) {
+    aiVector3D scaling, position;
+    aiQuaternion rotation;
+    matrix.Decompose(scaling, rotation, position);
+    return {{position.x, position.y, position.z},
+            {rotation.x, rotation.y, rotation.z, rotation.w},
+            {scaling.x, scaling.y, scaling.z}};
+}
+
+// Joints are the skinned bones plus any node linking two of them, returns
+// whether the subtree holds a bone
+static bool find_joints(const aiNode* node,
+                        const std::unordered_set<std::string>& bones,
+                        bool below_bone,
+                        std::unordered_set<const aiNode*>& joints) {
+    bool is_bone = bones.count(node->mName.C_Str());
+    bool bone_below = false;
+    for (size_t i = 0; i < node->mNumChildren; i++)
+        bone_below |= find_joints(node->mChildren[i], bones,
+                                  below_bone || is_bone, joints);
+    if (is_bone || (below_bone && bone_below))
+        joints.insert(node);
+    return is_bone || bone_below;
+}
+
+static void add_joints(const aiNode* node,
+                       const std::unordered_set<const aiNode*>& joints,
+                       RawSkeleton::Joint::Children& siblings) {
+    auto children = &siblings;
+    if (joints.count(node)) {
+        auto& joint = siblings.emplace_back();
+        joint.name = node->mName.C_Str();
+        joint.transform = to_transform(node->mTransformation);
+        children = &joint.children;
+    }
+    for (size_t i = 0; i < node->mNumChildren; i++)
+        add_joints(node->mChildren[i], joints, *children);
+}
+
+struct Source {
+    Source(AssetData _data, const ImportSettings& settings)
+        : data(std::move(_data)) {
+        auto format = std::filesystem::path(settings.source).extension().string();
+        scene = importer.ReadFileFromMemory(
+            data.bytes.data(), data.bytes.size(), 0, format.c_str() + 1);
+        if (!scene) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to import source={}", settings.source);
+            Log::exit(1);
+        }
+        // Root joints keep their own transform only, like ozz's own gltf2ozz
+        std::unordered_set<std::string> bones;
+        for (size_t i = 0; i < scene->mNumMeshes; i++)
+            for (size_t j = 0; j < scene->mMeshes[i]->mNumBones; j++)
+                bones.insert(scene->mMeshes[i]->mBones[j]->mName.C_Str());
+        std::unordered_set<const aiNode*> joints;
+        find_joints(scene->mRootNode, bones, false, joints);
+        add_joints(scene->mRootNode, joints, raw_skeleton.roots);
+        skeleton = ozz::animation::offline::SkeletonBuilder()(raw_skeleton);
+        if (!skeleton) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to build skeleton source={}", settings.source);
+            Log::exit(1);
+        }
+    }
+
+    int find_joint(std::string_view name) const {
+        auto names = skeleton->joint_names();
+        for (size_t i = 0; i < names.size(); i++)
+            if (name == names[i])
+                return i;
+        return -1;
+    }
+
+    AssetData data;
+    Assimp::Importer importer;
+    const aiScene* scene = nullptr;
+    RawSkeleton raw_skeleton;
+    ozz::unique_ptr<ozz::animation::Skeleton> skeleton;
+};
+
+template <typename T> static AssetData serialize(const T& object) {
+    ozz::io::MemoryStream stream;
+    ozz::io::OArchive output(&stream);
+    output << object;
+    AssetData data;
+    data.storage.resize(stream.Size());
+    stream.Seek(0, ozz::io::Stream::kSet);
+    stream.Read(data.storage.data(), data.storage.size());
+    data.bytes = data.storage;
+    return data;
+}
+
+std::string import_cache_path(std::span<const char> descriptor,
+                              std::span<const char> source) {
+    auto hash = hash_name({descriptor.data(), descriptor.size()}) ^
+                hash_name({source.data(), source.size()}) * 1099511628211ull;
+    std::ostringstream path;
+    path << "cache/ozz/" << std::hex << hash << ".ozz";
+    return path.str();
+}
+
+template <typename Cook>
+static AssetData cached(const AssetArchive& archive,
+                        std::span<const char> descriptor, Cook&& cook) {
+    auto settings = parse_import_settings(descriptor);
+    auto source = archive.read(settings.source);
+    if (!source) {
+        LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open import source={}", settings.source);
+        Log::exit(1);
+    }
+    auto path = import_cache_path(descriptor, source.bytes);
+    if (auto data = archive.read(path))
+        return data;
+
+    auto data = cook(Source(std::move(source), settings), settings);
+    auto file = std::filesystem::path(archive.root) / path;
+    std::filesystem::create_directories(file.parent_path());
+    std::ofstream(file, std::ios::binary)
+        .write(data.bytes.data(), data.bytes.size());
+    return data;
+}
+
+AssetData import_skeleton(const AssetArchive& archive,
+                          std::span<const char> descriptor) {
+    return cached(archive, descriptor, [](const Source& source, auto&) {
+        return serialize(*source.skeleton);
+    });
+}
+
+AssetData import_animation(const AssetArchive& archive,
+                           std::span<const char> descriptor) {
+    return cached(archive, descriptor, [](const Source& source,
+                                          const ImportSettings& settings) {
+        auto scene = source.scene;
+        auto clip = std::find_if(
+            scene->mAnimations, scene->mAnimations + scene->mNumAnimations,
+            [&](auto animation) { return settings.clip == animation->mName.C_Str(); });
+        if (clip == scene->mAnimations + scene->mNumAnimations) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "No such clip clip={} source={}", settings.clip, settings.source);
+            Log::exit(1);
+        }
+        auto animation = *clip;
+        double ticks_per_second =
+            animation->mTicksPerSecond > 0 ? animation->mTicksPerSecond : 25;
+
+        RawAnimation raw;
+        raw.duration = std::max(
+            float(animation->mDuration / ticks_per_second), 1e-3f);
+        raw.tracks.resize(source.skeleton->num_joints());
+        auto time = [&](double ticks) {
+            return std::clamp(float(ticks / ticks_per_second), 0.0f,
+                              raw.duration);
+        };
+        for (size_t i = 0; i < animation->mNumChannels; i++) {
+            auto channel = animation->mChannels[i];
+            auto joint = source.find_joint(channel->mNodeName.C_Str());
+            if (joint < 0)
+                continue;
+            auto& track = raw.tracks[joint];
+            for (size_t j = 0; j < channel->mNumPositionKeys; j++) {
+                auto& key = channel->mPositionKeys[j];
+                track.translations.push_back(
+                    {time(key.mTime), {key.mValue.x, key.mValue.y, key.mValue.z}});
+            }
+            for (size_t j = 0; j < channel->mNumRotationKeys; j++) {
+                auto& key = channel->mRotationKeys[j];
+                track.rotations.push_back(
+                    {time(key.mTime),
+                     {key.mValue.x, key.mValue.y, key.mValue.z, key.mValue.w}});
+            }
+            for (size_t j = 0; j < channel->mNumScalingKeys; j++) {
+                auto& key = channel->mScalingKeys[j];
+                track.scales.push_back(
+                    {time(key.mTime), {key.mValue.x, key.mValue.y, key.mValue.z}});
+            }
+        }
+        // Empty tracks would sample identity, hold the rest pose instead
+        ozz::animation::offline::IterateJointsDF(
+            source.raw_skeleton, [&](const RawSkeleton::Joint& current,
+                                     const RawSkeleton::Joint*) {
+                auto& track = raw.tracks[source.find_joint(current.name.c_str())];
+                if (track.translations.empty())
+                    track.translations.push_back({0, current.transform.translation});
+                if (track.rotations.empty())
+                    track.rotations.push_back({0, current.transform.rotation});
+                if (track.scales.empty())
+                    track.scales.push_back({0, current.transform.scale});
+            });
+
+        ozz::animation::offline::AnimationOptimizer optimizer;
+        optimizer.setting = {settings.tolerance, settings.distance};
+        for (auto& [name, joint] : settings.joints)
+            if (auto index = source.find_joint(name); index >= 0)
+                optimizer.joints_setting_override[index] = {joint.tolerance,
+                                                            joint.distance};
+        RawAnimation optimized;
+        if (!optimizer(raw, *source.skeleton, &optimized)) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to optimize clip={} source={}", settings.clip, settings.source);
+            Log::exit(1);
+        }
+        auto runtime = ozz::animation::offline::AnimationBuilder()(optimized);
+        if (!runtime) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to build clip={} source={}", settings.clip, settings.source);
+            Log::exit(1);
+        }
+        return serialize(*runtime);
+    });
+}
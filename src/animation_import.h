@@ -0,0 +1,41 @@
+#ifndef ANIMATION_IMPORT_H_
+#define ANIMATION_IMPORT_H_
+#include <string>
+#include <unordered_map>
+
+#include "asset_archive.h"
+
+// Import descriptor, e.g. skeletons/fox_skeleton.json or
+// animations/fox_run.json:
+//   {"source": "meshes/fox.glb", "clip": "Run",
+//    "tolerance": 0.001, "distance": 0.1,
+//    "joints": {"b_Head_05": {"tolerance": 0.0001}}}
+// Tolerances are in meters, measured at distance from each joint.
+struct ImportSettings {
+    struct Joint {
+        float tolerance;
+        float distance;
+    };
+
+    std::string source;
+    // Empty for skeletons
+    std::string clip;
+    float tolerance = 1e-3f;
+    float distance = 1e-1f;
+    std::unordered_map<std::string, Joint> joints;
+};
+
+ImportSettings parse_import_settings(std::span<const char> json);
+
+// Cook runtime ozz archives from a glTF source. Results are cached under
+// cache/ozz by hash of the source and the descriptor, so only changed
+// assets are rebuilt.
+AssetData import_skeleton(const AssetArchive& archive,
+                          std::span<const char> descriptor);
+AssetData import_animation(const AssetArchive& archive,
+                           std::span<const char> descriptor);
+// Archive path the import of source through descriptor is cached under
+std::string import_cache_path(std::span<const char> descriptor,
+                              std::span<const char> source);
+
+#endif // ANIMATION_IMPORT_H_
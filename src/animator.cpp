@@ -2,58 +2,153 @@
 #include "graphics.h"
 #include "mesh.h"
 #include "model.h"
+#include "profiler.h"
 #include "scripting.h"
 
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
 SkeletalAnimation::SkeletalAnimation(ModelHandle _model, AnimationHandle _animation)
-    : model(_model), animation(_animation) {
-    locals.resize(model->skeleton->num_soa_joints());
-    models.resize(model->skeleton->num_joints());
-    skinning_matrices.resize(model->mesh->inverse_binds.size());
+    : model(_model), animation(_animation), pose(model->poses->acquire()) {}
+
+SkeletalAnimation::SkeletalAnimation(SkeletalAnimation&& moved)
+    : time_ratio(moved.time_ratio), model(std::move(moved.model)),
+      animation(std::move(moved.animation)),
+      pose(std::exchange(moved.pose, PosePool::none)),
+      palette_offset(moved.palette_offset), bound_generation(moved.bound_generation),
+      bound_offset(moved.bound_offset) {}
+
+SkeletalAnimation& SkeletalAnimation::operator=(SkeletalAnimation&& moved) {
+    if (this == &moved)
+        return *this;
+    if (pose != PosePool::none)
+        model->poses->release(pose);
+    time_ratio = moved.time_ratio;
+    model = std::move(moved.model);
+    animation = std::move(moved.animation);
+    pose = std::exchange(moved.pose, PosePool::none);
+    palette_offset = moved.palette_offset;
+    bound_generation = moved.bound_generation;
+    bound_offset = moved.bound_offset;
+    return *this;
+}
+
+SkeletalAnimation::~SkeletalAnimation() {
+    if (pose != PosePool::none)
+        model->poses->release(pose);
+}
+
+PosePool* SkeletalAnimation::pool() const {
+    return model->poses.get();
+}
+
+ozz::span<ozz::math::SoaTransform> SkeletalAnimation::locals() {
+    return model->poses->locals(pose);
+}
+
+ozz::span<ozz::math::Float4x4> SkeletalAnimation::models() {
+    return model->poses->models(pose);
+}
+
+ozz::span<ozz::math::Float4x4> SkeletalAnimation::skinning_matrices() {
+    return model->poses->skinning_matrices(pose);
 }
 
 void SkeletalAnimation::update(float dt) {
     time_ratio += dt / animation->duration();
     if (time_ratio > 1)
         time_ratio -= std::floor(time_ratio);
-    ozz::animation::SamplingCache cache;
-    cache.Resize(model->skeleton->num_joints());
+    auto& poses = *model->poses;
+    auto pose_locals = poses.locals(pose);
+    auto pose_models = poses.models(pose);
+    auto pose_skinning = poses.skinning_matrices(pose);
     ozz::animation::SamplingJob sampling_job;
     sampling_job.animation = animation;
-    sampling_job.cache = &cache;
+    sampling_job.cache = &poses.cache(pose);
     sampling_job.ratio = time_ratio;
-    sampling_job.output = ozz::make_span(locals);
+    sampling_job.output = pose_locals;
     sampling_job.Run();
     ozz::animation::LocalToModelJob ltm_job;
     ltm_job.skeleton = model->skeleton;
-    ltm_job.input = ozz::make_span(locals);
-    ltm_job.output = ozz::make_span(models);
+    ltm_job.input = pose_locals;
+    ltm_job.output = pose_models;
     ltm_job.Run();
-    for (size_t i = 0; i < models.size(); ++i) {
-        // TODO: Get rid of the bone lookup
-        auto bone_name = model->skeleton->joint_names()[i];
-        auto it = model->mesh->bone_name_to_index.find(bone_name);
-        if (it != model->mesh->bone_name_to_index.end()) {
-            auto bone_index = it->second;
-            skinning_matrices[bone_index] =
-                models[i] * model->mesh->inverse_binds[bone_index];
-        }
+    for (size_t i = 0; i < pose_models.size(); ++i) {
+        auto bone_index = model->joint_bones[i];
+        if (bone_index >= 0)
+            pose_skinning[bone_index] =
+                pose_models[i] * model->mesh->inverse_binds[bone_index];
     }
 }
 
 void Animator::update(float dt, entt::registry& registry) {
-    auto view = registry.view<SkeletalAnimation>();
-    for(auto [entity, anim] : view.each())
+    PROFILE_ZONE("Animator::update");
+    // Owns SkeletalAnimation, so the pool is packed with the skinned ones
+    // first; Renderable is sorted by Graphics and cannot be owned as well
+    auto group = registry.group<SkeletalAnimation>(entt::get<Renderable>);
+    auto in_pose_order = [](const SkeletalAnimation& a, const SkeletalAnimation& b) {
+        return std::make_pair(a.pool(), a.pose) < std::make_pair(b.pool(), b.pose);
+    };
+    // Spawning and despawning shuffle the pool, walking it in pose order
+    // keeps the pose reads and writes sequential
+    const SkeletalAnimation* previous = nullptr;
+    for (auto entity : group) {
+        auto& anim = group.get<SkeletalAnimation>(entity);
+        if (previous && in_pose_order(anim, *previous)) {
+            group.sort<SkeletalAnimation>(in_pose_order);
+            break;
+        }
+        previous = &anim;
+    }
+    for (auto [entity, anim, renderable] : group.each())
+        anim.update(dt);
+    // Not drawn, but scripts may still read their poses
+    for (auto [entity, anim] : registry.view<SkeletalAnimation>(entt::exclude<Renderable>).each())
         anim.update(dt);
 }
 
 void Animator::update_renderables(entt::registry& registry, Graphics& graphics) {
-    auto view = registry.view<SkeletalAnimation, Renderable>();
+    PROFILE_ZONE("Animator::update_renderables");
+    auto group = registry.group<SkeletalAnimation>(entt::get<Renderable>);
+    bones.clear();
+    palette_offsets.clear();
+    for (auto [entity, anim, renderable] : group.each()) {
+        auto skinning = anim.skinning_matrices();
+        auto matrices = reinterpret_cast<const filament::math::mat4f*>(
+            skinning.begin());
+        auto count = skinning.size();
+        std::string_view bytes(reinterpret_cast<const char*>(matrices),
+                               count * sizeof(filament::math::mat4f));
+        auto hash = std::hash<std::string_view>()(bytes);
+        auto [begin, end] = palette_offsets.equal_range(hash);
+        auto it = std::find_if(begin, end, [&](auto& palette) {
+            return std::memcmp(&bones[palette.second], bytes.data(),
+                               bytes.size()) == 0;
+        });
+        if (it == end) {
+            // Ranges are bound as uniform buffer ranges, which must start at
+            // a multiple of 256 bytes
+            bones.resize((bones.size() + 3) / 4 * 4);
+            it = palette_offsets.emplace(hash, bones.size());
+            bones.insert(bones.end(), matrices, matrices + count);
+        }
+        anim.palette_offset = it->second;
+    }
+    graphics.upload_bones(bones);
+
     auto& renderable_manager = graphics.engine->getRenderableManager();
-    for(auto [entity, anim, renderable] : view.each()) {
-        auto renderable_instance = renderable_manager.getInstance(renderable.entity);
-        renderable_manager.setBones(renderable_instance,
-                reinterpret_cast<filament::math::mat4f*>(anim.skinning_matrices.data()),
-                anim.skinning_matrices.size());
+    for (auto [entity, anim, renderable] : group.each()) {
+        // A rebuilt buffer may reuse the old one's address
+        if (anim.bound_generation == graphics.skinning_generation &&
+            anim.bound_offset == anim.palette_offset)
+            continue;
+        renderable_manager.setSkinningBuffer(
+            renderable_manager.getInstance(renderable.entity),
+            graphics.skinning_buffer, anim.pool()->bones,
+            anim.palette_offset);
+        anim.bound_generation = graphics.skinning_generation;
+        anim.bound_offset = anim.palette_offset;
     }
 }
 
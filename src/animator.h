@@ -11,19 +11,38 @@
 #include "ozz/base/maths/vec_float.h"
 #include "ozz/options/options.h"
 #include <entt/entt.hpp>
+#include <math/mat4.h>
+#include <unordered_map>
+#include "pose_pool.h"
 #include "primitives.h"
 
+namespace filament {
+    class SkinningBuffer;
+}
+
+// Owns a slot of its model's PosePool, hence move-only
 struct SkeletalAnimation {
     SkeletalAnimation(ModelHandle model, AnimationHandle animation);
+    SkeletalAnimation(SkeletalAnimation&& moved);
+    SkeletalAnimation& operator=(SkeletalAnimation&& moved);
+    ~SkeletalAnimation();
     void update(float dt);
 
-    std::vector<ozz::math::SoaTransform> locals;
-    std::vector<ozz::math::Float4x4> models;
-    std::vector<ozz::math::Float4x4> skinning_matrices;
+    PosePool* pool() const;
+    ozz::span<ozz::math::SoaTransform> locals();
+    ozz::span<ozz::math::Float4x4> models();
+    ozz::span<ozz::math::Float4x4> skinning_matrices();
 
     float time_ratio = 0;
     ModelHandle model;
     AnimationHandle animation;
+    uint32_t pose = PosePool::none;
+
+    // Range of the shared skinning buffer holding this frame's palette
+    uint32_t palette_offset = 0;
+    // Graphics::skinning_generation when bound, 0 if never bound
+    uint64_t bound_generation = 0;
+    uint32_t bound_offset = 0;
 };
 
 struct Graphics;
@@ -33,6 +52,10 @@ struct Animator {
     void update_renderables(entt::registry& registry, Graphics& graphics);
 
     void bind(Scripting& scripting);
+
+    std::vector<filament::math::mat4f> bones;
+    // Palette hash to offset in bones, lets identical poses share a range
+    std::unordered_multimap<size_t, uint32_t> palette_offsets;
 };
 
 #endif
@@ -0,0 +1,143 @@
+#include "asset_archive.h"
+#include "asset_library.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Every range the loaders will touch must lie inside the mapping, so that a
+// truncated or corrupt archive is rejected here rather than read past its end
+static bool validate(const char* base, size_t size, const PakHeader& header) {
+    if (std::memcmp(header.magic, PakHeader().magic, 4) != 0 ||
+        header.version != PakHeader::current_version)
+        return false;
+    if (header.names_offset > header.toc_offset || header.toc_offset > size ||
+        header.toc_offset % alignof(PakEntry) != 0 ||
+        header.entry_count > (size - header.toc_offset) / sizeof(PakEntry))
+        return false;
+    // Names are null terminated, the last one before the table at the latest
+    if (header.names_offset < header.toc_offset && base[header.toc_offset - 1] != '\0')
+        return false;
+    auto entries = reinterpret_cast<const PakEntry*>(base + header.toc_offset);
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        auto& entry = entries[i];
+        if (entry.offset > header.names_offset ||
+            entry.stored_size > header.names_offset - entry.offset ||
+            entry.name_offset >= header.toc_offset - header.names_offset)
+            return false;
+        if (entry.codec == PakCodec::NONE ? entry.stored_size != entry.size
+                                          : entry.codec != PakCodec::ZLIB)
+            return false;
+    }
+    return true;
+}
+
+AssetArchive::~AssetArchive() {
+    if (mapping)
+        munmap(mapping, mapping_size);
+}
+
+bool AssetArchive::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(PakHeader)) {
+        close(fd);
+        return false;
+    }
+    auto map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    auto base = static_cast<const char*>(map);
+    PakHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (!validate(base, st.st_size, header)) {
+        LOG_ERROR(logger(LogChannel::ASSETS), "Invalid asset archive path={}", path);
+        munmap(map, st.st_size);
+        return false;
+    }
+    mapping = map;
+    mapping_size = st.st_size;
+    entries = {reinterpret_cast<const PakEntry*>(base + header.toc_offset),
+               header.entry_count};
+    names = base + header.names_offset;
+    return true;
+}
+
+const PakEntry* AssetArchive::find(std::string_view path) const {
+    auto hash = hash_name(path);
+    auto it = std::lower_bound(
+        entries.begin(), entries.end(), hash,
+        [](const PakEntry& entry, uint64_t hash) { return entry.hash < hash; });
+    if (it == entries.end() || it->hash != hash)
+        return nullptr;
+    return &*it;
+}
+
+AssetData AssetArchive::read(const std::string& path) const {
+    AssetData data;
+    if (auto entry = find(path)) {
+        auto stored = static_cast<const char*>(mapping) + entry->offset;
+        data.found = true;
+        if (entry->codec == PakCodec::NONE) {
+            data.bytes = {stored, entry->size};
+            return data;
+        }
+        data.storage.resize(entry->size);
+        uLongf size = entry->size;
+        if (uncompress(reinterpret_cast<Bytef*>(data.storage.data()), &size,
+                       reinterpret_cast<const Bytef*>(stored),
+                       entry->stored_size) != Z_OK ||
+            size != entry->size) {
+            LOG_ERROR(logger(LogChannel::ASSETS), "Failed to decompress asset={}", path);
+            return {};
+        }
+        data.bytes = data.storage;
+        return data;
+    }
+    std::ifstream file(root + path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return data;
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    data.storage.resize(size);
+    if (file.read(data.storage.data(), size)) {
+        data.bytes = data.storage;
+        data.found = true;
+    }
+    return data;
+}
+
+std::vector<std::string> AssetArchive::list(std::string_view prefix) const {
+    std::vector<std::string> paths;
+    for (auto& entry : entries) {
+        std::string_view name = names + entry.name_offset;
+        if (name.substr(0, prefix.size()) == prefix)
+            paths.emplace_back(name);
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+size_t SpanStream::Read(void* buffer, size_t size) {
+    size = std::min(size, data.size() - position);
+    std::memcpy(buffer, data.data() + position, size);
+    position += size;
+    return size;
+}
+
+int SpanStream::Seek(int offset, Origin origin) {
+    int base = origin == kSet ? 0 : origin == kEnd ? int(data.size()) : position;
+    if (base + offset < 0 || size_t(base + offset) > data.size())
+        return -1;
+    position = base + offset;
+    return 0;
+}
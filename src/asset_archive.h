@@ -0,0 +1,90 @@
+#ifndef ASSET_ARCHIVE_H_
+#define ASSET_ARCHIVE_H_
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ozz/base/io/stream.h"
+
+// Packed asset archive layout:
+//   PakHeader | entry data, each aligned to alignment | names | PakEntry[]
+// Entries are sorted by hash, the hash being hash_name of the path relative
+// to the assets directory, e.g. "meshes/fox.glb".
+struct PakHeader {
+    static constexpr uint32_t current_version = 1;
+
+    char magic[4] = {'M', 'P', 'A', 'K'};
+    uint32_t version = current_version;
+    uint32_t entry_count = 0;
+    uint32_t alignment = 64;
+    uint64_t names_offset = 0;
+    uint64_t toc_offset = 0;
+};
+
+enum class PakCodec : uint32_t { NONE, ZLIB };
+
+struct PakEntry {
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t stored_size;
+    PakCodec codec;
+    uint32_t name_offset;
+};
+
+// Bytes of one asset, either a view into the mapped archive or owned when
+// decompressed or read from a loose file
+struct AssetData {
+    AssetData() = default;
+    AssetData(const AssetData&) = delete;
+    AssetData(AssetData&&) = default;
+
+    AssetData& operator=(const AssetData&) = delete;
+    AssetData& operator=(AssetData&&) = default;
+
+    // Empty assets are found too, they just have no bytes
+    explicit operator bool() const { return found; }
+
+    std::span<const char> bytes;
+    std::vector<char> storage;
+    bool found = false;
+};
+
+struct AssetArchive {
+    AssetArchive() = default;
+    AssetArchive(const AssetArchive&) = delete;
+    ~AssetArchive();
+
+    AssetArchive& operator=(const AssetArchive&) = delete;
+
+    bool open(const std::string& path);
+    const PakEntry* find(std::string_view path) const;
+    // Looks the path up in the archive first, then under the loose root
+    AssetData read(const std::string& path) const;
+    std::vector<std::string> list(std::string_view prefix) const;
+
+    std::string root = "assets/";
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    std::span<const PakEntry> entries;
+    const char* names = nullptr;
+};
+
+// Read-only ozz stream over memory, lets ozz archives load from the mapping
+struct SpanStream : public ozz::io::Stream {
+    SpanStream(std::span<const char> _data) : data(_data) {}
+
+    bool opened() const override { return true; }
+    size_t Read(void* buffer, size_t size) override;
+    size_t Write(const void* buffer, size_t size) override { return 0; }
+    int Seek(int offset, Origin origin) override;
+    int Tell() const override { return position; }
+    size_t Size() const override { return data.size(); }
+
+    std::span<const char> data;
+    int position = 0;
+};
+
+#endif // ASSET_ARCHIVE_H_
@@ -1,81 +1,125 @@
 #include "asset_library.h"
+#include "animation_import.h"
+#include "audio.h"
+#include "graphics.h"
 #include "material.h"
 #include "mesh.h"
 #include "model.h"
+#include "prefab.h"
 #include "ozz/animation/runtime/animation.h"
 #include "ozz/animation/runtime/skeleton.h"
 #include "ozz/base/io/archive.h"
 #include "ozz/base/io/stream.h"
-#include "ozz/base/log.h"
+#include "log.h"
 
 #include <filament/Engine.h>
 #include <filament/Material.h>
 #include <filament/MaterialInstance.h>
-#include <fstream>
+#include <soloud_wav.h>
+#include <soloud_wavstream.h>
+#include <cstring>
+#include <doctest/doctest.h>
+#include <filesystem>
+#include <mutex>
 #undef assert_invariant
 #include <nlohmann/json.hpp>
 #include "primitives.h"
 #include "scripting.h"
 
+// Sound sources larger than this stream unless their descriptor says otherwise
+static constexpr size_t stream_threshold = 1 << 20;
+
+static std::mutex asset_names_mutex;
+static std::unordered_map<AssetId, std::string> asset_names;
+
+AssetId intern_asset(std::string_view name) {
+    AssetId id(name);
+    std::lock_guard lock(asset_names_mutex);
+    auto [it, inserted] = asset_names.try_emplace(id, name);
+    if (!inserted && it->second != name) {
+        LOG_CRITICAL(logger(LogChannel::ASSETS), "Asset name collision asset={} other={}",
+                     std::string(name), it->second);
+        Log::exit(1);
+    }
+    return id;
+}
+
+const std::string& asset_name(AssetId id) {
+    std::lock_guard lock(asset_names_mutex);
+    auto it = asset_names.find(id);
+    if (it == asset_names.end()) {
+        LOG_CRITICAL(logger(LogChannel::ASSETS), "Unknown asset id={}", id.hash);
+        Log::exit(1);
+    }
+    return it->second;
+}
+
+void log_asset_load(AssetId id, uint64_t nanoseconds) {
+    LOG_DEBUG(logger(LogChannel::ASSETS), "Loaded asset={} ms={:.3f}",
+              asset_name(id), nanoseconds * 1e-6);
+}
+
 AssetLibrary::AssetLibrary(filament::Engine& engine) {
-    animations.load = [](auto name) {
-        auto filename = "assets/animations/" + name + ".ozz";
-        ozz::io::File file(filename.c_str(), "rb");
-        if (!file.opened()) {
-            ozz::log::Err() << "Failed to open animation file '" << filename
-                            << "''." << std::endl;
-            std::exit(1);
+    archive.open("assets.pak");
+    // Intern everything up front so compile-time ids resolve
+    for (auto& path : archive.list(""))
+        intern_asset(std::filesystem::path(path).stem().string());
+    if (std::filesystem::is_directory("assets"))
+        for (auto& dir : std::filesystem::directory_iterator("assets"))
+            if (dir.is_directory())
+                for (auto& file : std::filesystem::directory_iterator(dir))
+                    intern_asset(file.path().stem().string());
+    animations.load = [this](auto name) {
+        auto filename = "animations/" + name + ".ozz";
+        auto data = archive.read(filename);
+        if (!data)
+            if (auto descriptor = archive.read("animations/" + name + ".json"))
+                data = import_animation(archive, descriptor.bytes);
+        if (!data) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open animation file={}", filename);
+            Log::exit(1);
         }
-        ozz::io::IArchive archive(&file);
-        if (!archive.TestTag<ozz::animation::Animation>()) {
-            ozz::log::Err() << "Failed to load animation instance from file '"
-                            << filename << "'." << std::endl;
-            std::exit(1);
+        SpanStream stream(data.bytes);
+        ozz::io::IArchive input(&stream);
+        if (!input.TestTag<ozz::animation::Animation>()) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to load animation file={}", filename);
+            Log::exit(1);
         }
         auto animation = new ozz::animation::Animation;
-        archive >> *animation;
+        input >> *animation;
         return animation;
     };
     animations.unload = [](auto animation) { delete animation; };
+    animations.size_of = [](auto animation) { return animation->size(); };
     materials.load = [this](auto name) {
-        auto filename = "assets/materials/" + name + ".json";
-        std::ifstream file(filename);
-        nlohmann::json j;
-        file >> j;
-        auto shader = shaders[j["shader"]];
+        auto data = archive.read("materials/" + name + ".json");
+        auto j = nlohmann::json::parse(data.bytes.begin(), data.bytes.end());
+        auto shader = shaders[j["shader"].get<std::string>()];
         auto instance = shader->createInstance(name.c_str());
         auto param_count = shader->getParameterCount();
         std::vector<filament::Material::ParameterInfo> param_info(param_count);
         shader->getParameters(param_info.data(), param_count);
+        std::vector<MaterialParameter> parameters;
         for (auto& pi : param_info) {
             auto json_value = j[pi.name];
+            MaterialParameter parameter{intern_asset(pi.name), 0, Vec4f{0}};
             switch (pi.type) {
             case filament::Material::ParameterType::FLOAT:
-                instance->setParameter(pi.name, json_value.get<float>());
-                break;
-            case filament::Material::ParameterType::FLOAT2: {
-                Vec2f value{json_value.at(0).get<float>(),
-                            json_value.at(1).get<float>()};
-                instance->setParameter(pi.name, value);
+                parameter.components = 1;
+                parameter.value.x = json_value.get<float>();
                 break;
-            }
-            case filament::Material::ParameterType::FLOAT3: {
+            case filament::Material::ParameterType::FLOAT2:
+            case filament::Material::ParameterType::FLOAT3:
+            case filament::Material::ParameterType::FLOAT4:
                 // XXX instance->setParameter("baseColor",
                 // filament::RgbType::sRGB, Value3f(0.8, 0, 0));
-                Vec3f value{json_value.at(0).get<float>(),
-                            json_value.at(1).get<float>(),
-                            json_value.at(2).get<float>()};
-                instance->setParameter(pi.name, value);
+                parameter.components =
+                    pi.type == filament::Material::ParameterType::FLOAT2   ? 2
+                    : pi.type == filament::Material::ParameterType::FLOAT3 ? 3
+                                                                           : 4;
+                for (uint8_t i = 0; i < parameter.components; i++)
+                    parameter.value[i] = json_value.at(i).get<float>();
                 break;
-            }
-            case filament::Material::ParameterType::FLOAT4: {
-                Vec4f value{json_value.at(0).get<float>(),
-                            json_value.at(1).get<float>(),
-                            json_value.at(2).get<float>(),
-                            json_value.at(3).get<float>()};
-                instance->setParameter(pi.name, value);
-                break;
-            }
             case filament::Material::ParameterType::BOOL:
             case filament::Material::ParameterType::BOOL2:
             case filament::Material::ParameterType::BOOL3:
@@ -92,108 +136,306 @@ AssetLibrary::AssetLibrary(filament::Engine& engine) {
             case filament::Material::ParameterType::MAT3:
             case filament::Material::ParameterType::MAT4:
             default:
-                std::exit(1);
+                LOG_CRITICAL(logger(LogChannel::ASSETS), "Unsupported material parameter type material={} parameter={}",
+                             name, pi.name);
+                Log::exit(1);
             }
+            apply_parameter(instance, parameter);
+            parameters.push_back(parameter);
         }
-        return new Material{instance, shader};
+        return new Material{instance, shader, parameters};
     };
     materials.unload = [&engine](auto material) {
-        engine.destroy(material->instance);
+        material->destroy(engine);
+        delete material;
     };
-    meshes.load = [&engine](auto name) {
-        auto filename = "assets/meshes/" + name + ".glb";
-        return new Mesh(engine, filename);
+    materials.size_of = [](auto material) {
+        // Approximates the instance's uniform block
+        return (1 + material->variants.size()) *
+               (sizeof(Material) +
+                material->shader->getParameterCount() * sizeof(Vec4f));
+    };
+    meshes.load = [this, &engine](auto name) {
+        auto filename = "meshes/" + name + ".glb";
+        auto data = archive.read(filename);
+        if (!data) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open mesh file={}", filename);
+            Log::exit(1);
+        }
+        return new Mesh(engine, data.bytes, "glb");
     };
     meshes.unload = [&engine](auto mesh) {
         for (auto& part : mesh->parts) {
             engine.destroy(part.index_buffer);
             engine.destroy(part.vertex_buffer);
         }
+        MemoryTracker::get().free(MemoryTag::GRAPHICS, mesh->gpu_size);
         delete mesh;
     };
+    meshes.size_of = [](auto mesh) {
+        // CPU copies plus the GPU buffers uploaded from them
+        return 2 * mesh->gpu_size;
+    };
     models.load = [this](auto name) {
-        auto filename = "assets/models/" + name + ".json";
-        std::ifstream file(filename);
-        nlohmann::json json;
-        file >> json;
-        auto mesh = meshes[json["mesh"]];
-        auto material = materials[json["material"]];
-        auto skeleton = skeletons[json["skeleton"]];
+        auto data = archive.read("models/" + name + ".json");
+        auto json = nlohmann::json::parse(data.bytes.begin(), data.bytes.end());
+        auto mesh = meshes[json["mesh"].get<std::string>()];
+        auto material = materials[json["material"].get<std::string>()];
+        auto skeleton = skeletons[json["skeleton"].get<std::string>()];
         std::vector<AnimationHandle> model_anims;
         for (auto anim : json["animations"]) {
-            model_anims.push_back(animations[anim]);
+            model_anims.push_back(animations[anim.get<std::string>()]);
         }
-        return new Model{mesh, material, skeleton, model_anims};
+        // Resolve joint names once instead of on every pose update
+        std::vector<int16_t> joint_bones;
+        for (auto joint_name : skeleton->joint_names()) {
+            auto it = mesh->bone_name_to_index.find(joint_name);
+            joint_bones.push_back(
+                it != mesh->bone_name_to_index.end() ? it->second : -1);
+        }
+        auto poses = std::make_unique<PosePool>(skeleton->num_soa_joints(),
+                                                skeleton->num_joints(),
+                                                mesh->inverse_binds.size());
+        return new Model{mesh, material, skeleton, model_anims, joint_bones,
+                         std::move(poses)};
     };
     models.unload = [](auto model) { delete model; };
-    shaders.load = [&engine](auto name) {
-        auto filename = "assets/shaders/" + name + ".filamat";
-        std::ifstream file(filename, std::ios::binary | std::ios::ate);
-        std::streamsize size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        std::vector<char> buffer(size);
-        if (file.read(buffer.data(), size))
-            return filament::Material::Builder()
-                .package(buffer.data(), buffer.size())
-                .build(engine);
-        else
-            std::exit(1);
+    prefabs.load = [this](auto name) {
+        auto data = archive.read("prefabs/" + name + ".json");
+        if (!data) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open prefab file=prefabs/{}.json", name);
+            Log::exit(1);
+        }
+        auto json = nlohmann::json::parse(data.bytes.begin(), data.bytes.end());
+        auto prefab = new Prefab{models[json["model"].get<std::string>()]};
+        if (json.contains("animation"))
+            prefab->animation = animations[json["animation"].get<std::string>()];
+        auto vec3 = [&](const char* key, Vec3f& value) {
+            if (json.contains(key))
+                for (int i = 0; i < 3; i++)
+                    value[i] = json[key][i].get<float>();
+        };
+        vec3("position", prefab->transform.position);
+        vec3("scale", prefab->transform.scale);
+        return prefab;
+    };
+    prefabs.unload = [](auto prefab) { delete prefab; };
+    shaders.load = [this, &engine](auto name) {
+        auto filename = "shaders/" + name + ".filamat";
+        auto data = archive.read(filename);
+        if (!data) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open shader file={}", filename);
+            Log::exit(1);
+        }
+        return filament::Material::Builder()
+            .package(data.bytes.data(), data.bytes.size())
+            .build(engine);
     };
     shaders.unload = [&engine](auto shader) { engine.destroy(shader); };
     skeletons.load =
-        [](auto name) {
-            auto filename = "assets/skeletons/" + name + ".ozz";
-            ozz::io::File file(filename.c_str(), "rb");
-            if (!file.opened()) {
-                ozz::log::Err() << "Failed to open skeleton file '" << filename
-                                << "''." << std::endl;
-                std::exit(1);
+        [this](auto name) {
+            auto filename = "skeletons/" + name + ".ozz";
+            auto data = archive.read(filename);
+            if (!data)
+                if (auto descriptor = archive.read("skeletons/" + name + ".json"))
+                    data = import_skeleton(archive, descriptor.bytes);
+            if (!data) {
+                LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open skeleton file={}", filename);
+                Log::exit(1);
             }
-            ozz::io::IArchive archive(&file);
-            if (!archive.TestTag<ozz::animation::Skeleton>()) {
-                ozz::log::Err()
-                    << "Failed to load skeleton instance from file '"
-                    << filename << "'." << std::endl;
-                std::exit(1);
+            SpanStream stream(data.bytes);
+            ozz::io::IArchive input(&stream);
+            if (!input.TestTag<ozz::animation::Skeleton>()) {
+                LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to load skeleton file={}", filename);
+                Log::exit(1);
             }
             auto skeleton = new ozz::animation::Skeleton;
-            archive >> *skeleton;
+            input >> *skeleton;
             return skeleton;
-        },
+        };
     skeletons.unload = [](auto skeleton) { delete skeleton; };
+    skeletons.size_of = [](auto skeleton) {
+        size_t size = skeleton->joint_rest_poses().size_bytes() +
+                      skeleton->joint_parents().size_bytes();
+        for (auto name : skeleton->joint_names())
+            size += std::strlen(name) + 1 + sizeof(name);
+        return size;
+    };
+    sounds.load = [this](auto name) {
+        auto descriptor = archive.read("sounds/" + name + ".json");
+        if (!descriptor) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open sound file=sounds/{}.json", name);
+            Log::exit(1);
+        }
+        auto json = nlohmann::json::parse(descriptor.bytes.begin(), descriptor.bytes.end());
+        auto source = json["source"].get<std::string>();
+        auto sound = new Sound{archive.read(source)};
+        if (!sound->data) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to open sound source={}", source);
+            Log::exit(1);
+        }
+        // Long tracks are decoded a buffer at a time on the audio thread
+        sound->streamed = json.value("stream", sound->data.bytes.size() > stream_threshold);
+        sound->looping = json.value("loop", false);
+        sound->volume = json.value("volume", 1.0f);
+        sound->min_distance = json.value("min_distance", 1.0f);
+        sound->max_distance = json.value("max_distance", 64.0f);
+        auto bytes = reinterpret_cast<const unsigned char*>(sound->data.bytes.data());
+        SoLoud::result result;
+        if (sound->streamed) {
+            auto stream = new SoLoud::WavStream;
+            result = stream->loadMem(bytes, sound->data.bytes.size(), false, false);
+            sound->length = stream->getLength();
+            sound->source.reset(stream);
+        } else {
+            auto wav = new SoLoud::Wav;
+            result = wav->loadMem(bytes, sound->data.bytes.size(), false, false);
+            sound->length = wav->getLength();
+            sound->source.reset(wav);
+            // Decoded samples are all that is needed from now on
+            sound->data = {};
+        }
+        if (result != SoLoud::SO_NO_ERROR) {
+            LOG_CRITICAL(logger(LogChannel::ASSETS), "Failed to decode sound source={}", source);
+            Log::exit(1);
+        }
+        sound->source->setLooping(sound->looping);
+        sound->source->set3dMinMaxDistance(sound->min_distance, sound->max_distance);
+        sound->source->set3dAttenuation(SoLoud::AudioSource::INVERSE_DISTANCE, 1);
+        return sound;
+    };
+    sounds.unload = [](auto sound) { delete sound; };
+    sounds.size_of = [](auto sound) {
+        if (sound->streamed)
+            return sound->data.bytes.size();
+        auto wav = static_cast<const SoLoud::Wav*>(sound->source.get());
+        return size_t(wav->mSampleCount) * wav->mChannels * sizeof(float);
+    };
+}
+
+void AssetLibrary::release_unused() {
+    // Dependents first so their handles are dropped before their dependencies
+    prefabs.release_unused();
+    sounds.release_unused();
+    models.release_unused();
+    materials.release_unused();
+    meshes.release_unused();
+    skeletons.release_unused();
+    animations.release_unused();
+    shaders.release_unused();
+}
+
+void AssetLibrary::update(size_t max_evictions) {
+    prefabs.touch();
+    sounds.touch();
+    models.touch();
+    materials.touch();
+    meshes.touch();
+    skeletons.touch();
+    animations.touch();
+    shaders.touch();
+    // Models and prefabs have no size of their own but keep meshes,
+    // materials, skeletons and clips referenced, drop the unused ones first
+    // so that whatever they held can be evicted in the same pass
+    bool dependencies_over_budget = meshes.over_budget() || materials.over_budget() ||
+                                    skeletons.over_budget() || animations.over_budget();
+    max_evictions -= prefabs.evict(max_evictions, dependencies_over_budget);
+    max_evictions -= sounds.evict(max_evictions);
+    max_evictions -= models.evict(max_evictions, dependencies_over_budget);
+    max_evictions -= materials.evict(max_evictions);
+    max_evictions -= meshes.evict(max_evictions);
+    max_evictions -= skeletons.evict(max_evictions);
+    max_evictions -= animations.evict(max_evictions);
+}
+
+TEST_CASE("Dropping the last model handle lets its mesh be evicted") {
+    Graphics graphics(64, 64);
+    AssetLibrary assets(*graphics.engine);
+    {
+        auto model = assets.models["fox"];
+        REQUIRE(assets.meshes.resident > 0);
+        assets.meshes.budget = assets.meshes.resident - 1;
+        assets.update();
+        CHECK(model);
+        CHECK(assets.meshes.over_budget());
+    }
+    assets.update();
+    CHECK_FALSE(assets.meshes.over_budget());
+    CHECK(assets.meshes.resident == 0);
+}
+
+template <typename Handle> static auto pin(bool pinned) {
+    return [pinned](Handle& handle) {
+        if (handle)
+            handle.slot->pinned = pinned;
+    };
 }
 
 void AssetLibrary::bind(Scripting& scripting) {
     auto& lua = scripting.lua;
     lua["assets"] = lua.create_table();
+    lua.new_usertype<AssetId>("AssetId", sol::meta_function::equal_to, [](AssetId a, AssetId b) { return a == b; });
+    lua["assets"]["id"] = [](std::string_view name) { return intern_asset(name); };
+    lua["assets"]["release_unused"] = [this]() { release_unused(); };
+    lua["assets"]["set_budget"] = [this](const std::string& category, size_t bytes) {
+        if (category == "meshes")
+            meshes.budget = bytes;
+        else if (category == "animations")
+            animations.budget = bytes;
+        else if (category == "materials")
+            materials.budget = bytes;
+        else if (category == "skeletons")
+            skeletons.budget = bytes;
+        else if (category == "sounds")
+            sounds.budget = bytes;
+        else
+            throw sol::error("Unknown asset category '" + category + "'");
+    };
+    lua["assets"]["resident"] = [this]() {
+        return std::make_tuple(meshes.resident, animations.resident, materials.resident, skeletons.resident, sounds.resident);
+    };
+    lua["assets"]["pin"] = sol::overload(pin<AnimationHandle>(true), pin<MeshHandle>(true), pin<ModelHandle>(true),
+                                         pin<ShaderHandle>(true), pin<MaterialHandle>(true), pin<SkeletonHandle>(true), pin<PrefabHandle>(true), pin<SoundHandle>(true));
+    lua["assets"]["unpin"] = sol::overload(pin<AnimationHandle>(false), pin<MeshHandle>(false), pin<ModelHandle>(false),
+                                           pin<ShaderHandle>(false), pin<MaterialHandle>(false), pin<SkeletonHandle>(false), pin<PrefabHandle>(false), pin<SoundHandle>(false));
 
     lua.new_usertype<AnimationHandle>("Animation");
     auto animations_table = lua["assets"]["animations"] = lua.create_table();
     auto animations_meta = animations_table[sol::metatable_key] = lua.create_table();
-    animations_meta[sol::meta_method::index] = [this](sol::table, const std::string& name) { return animations[name]; };
+    animations_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return animations[id]; }, [this](sol::table, std::string_view name) { return animations[name]; });
 
     lua.new_usertype<MeshHandle>("Mesh");
     auto meshes_table = lua["assets"]["meshes"] = lua.create_table();
     auto meshes_meta = meshes_table[sol::metatable_key] = lua.create_table();
-    meshes_meta[sol::meta_method::index] = [this](sol::table, const std::string& name) { return meshes[name]; };
+    meshes_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return meshes[id]; }, [this](sol::table, std::string_view name) { return meshes[name]; });
 
     lua.new_usertype<ModelHandle>("Model");
     auto models_table = lua["assets"]["models"] = lua.create_table();
     auto models_meta = models_table[sol::metatable_key] = lua.create_table();
-    models_meta[sol::meta_method::index] = [this](sol::table, const std::string& name) { return models[name]; };
+    models_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return models[id]; }, [this](sol::table, std::string_view name) { return models[name]; });
 
     lua.new_usertype<ShaderHandle>("Shader");
     auto shaders_table = lua["assets"]["shaders"] = lua.create_table();
     auto shaders_meta = shaders_table[sol::metatable_key] = lua.create_table();
-    shaders_meta[sol::meta_method::index] = [this](sol::table, const std::string& name) { return shaders[name]; };
+    shaders_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return shaders[id]; }, [this](sol::table, std::string_view name) { return shaders[name]; });
 
     lua.new_usertype<MaterialHandle>("Material");
     auto materials_table = lua["assets"]["materials"] = lua.create_table();
     auto materials_meta = materials_table[sol::metatable_key] = lua.create_table();
-    materials_meta[sol::meta_method::index] = [this](sol::table, const std::string& name) { return materials[name]; };
+    materials_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return materials[id]; }, [this](sol::table, std::string_view name) { return materials[name]; });
 
     lua.new_usertype<SkeletonHandle>("Skeleton");
     auto skeletons_table = lua["assets"]["skeletons"] = lua.create_table();
     auto skeletons_meta = skeletons_table[sol::metatable_key] = lua.create_table();
-    skeletons_meta[sol::meta_method::index] = [this](sol::table, const std::string& name) { return skeletons[name]; };
+    skeletons_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return skeletons[id]; }, [this](sol::table, std::string_view name) { return skeletons[name]; });
+
+    lua.new_usertype<PrefabHandle>("Prefab");
+    auto prefabs_table = lua["assets"]["prefabs"] = lua.create_table();
+    auto prefabs_meta = prefabs_table[sol::metatable_key] = lua.create_table();
+    prefabs_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return prefabs[id]; }, [this](sol::table, std::string_view name) { return prefabs[name]; });
+
+    lua.new_usertype<SoundHandle>("Sound");
+    auto sounds_table = lua["assets"]["sounds"] = lua.create_table();
+    auto sounds_meta = sounds_table[sol::metatable_key] = lua.create_table();
+    sounds_meta[sol::meta_method::index] = sol::overload([this](sol::table, AssetId id) { return sounds[id]; }, [this](sol::table, std::string_view name) { return sounds[name]; });
 }
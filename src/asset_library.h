@@ -1,65 +1,215 @@
 #ifndef ASSET_LIBRARY_H
 #define ASSET_LIBRARY_H
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "asset_archive.h"
+#include "profiler.h"
+
+// FNV-1a, constexpr so that literal names hash at compile time
+constexpr uint64_t hash_name(std::string_view name) {
+    uint64_t hash = 14695981039346656037ull;
+    for (auto c : name) {
+        hash ^= uint8_t(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+struct AssetId {
+    constexpr AssetId() = default;
+    constexpr explicit AssetId(std::string_view name) : hash(hash_name(name)) {}
+
+    constexpr bool operator==(const AssetId&) const = default;
+
+    uint64_t hash = 0;
+};
+
+constexpr AssetId operator""_asset(const char* name, size_t size) {
+    return AssetId({name, size});
+}
+
+namespace std {
+    template <> struct hash<AssetId> {
+        size_t operator()(AssetId id) const { return id.hash; }
+    };
+}
+
+// Registers the name behind an id so that assets can be loaded by id
+AssetId intern_asset(std::string_view name);
+const std::string& asset_name(AssetId id);
+// Debug log of how long an asset took to load
+void log_asset_load(AssetId id, uint64_t nanoseconds);
+
+// Lookups and loads must happen on the main thread, handles may be copied
+// and dropped from any thread.
 template <typename Asset> struct Library {
-    struct Wrapper {
-        Asset* asset;
-        mutable size_t ref_count = 0;
+    struct Slot {
+        Asset* asset = nullptr;
+        AssetId id;
+        uint32_t generation = 0;
+        std::atomic<uint32_t> ref_count = 0;
+        size_t size = 0;
+        uint64_t last_used = 0;
+        bool pinned = false;
     };
 
     struct Handle {
-        Handle() : wrapper(nullptr) {}
-        Handle(Wrapper* _wrapper) : wrapper(_wrapper) { ++wrapper->ref_count; }
-        ~Handle() { --wrapper->ref_count; }
-
-        operator bool() const { return wrapper; }
-        operator Asset*() { return wrapper->asset; }
-        operator const Asset*() const { return wrapper->asset; }
-        Asset* operator->() { return wrapper->asset; }
-        const Asset* operator->() const { return wrapper->asset; }
-        Asset& operator*() { return *wrapper->asset; }
-        const Asset& operator*() const { return *wrapper->asset; }
-
-        Wrapper* wrapper;
+        Handle() = default;
+        Handle(Slot* _slot) : slot(_slot), generation(_slot->generation) {
+            acquire();
+        }
+        Handle(const Handle& other)
+            : slot(other.slot), generation(other.generation) {
+            acquire();
+        }
+        Handle(Handle&& moved)
+            : slot(moved.slot), generation(moved.generation) {
+            moved.slot = nullptr;
+        }
+        ~Handle() { release(); }
+
+        Handle& operator=(Handle other) {
+            std::swap(slot, other.slot);
+            std::swap(generation, other.generation);
+            return *this;
+        }
+
+        operator bool() const { return slot && slot->generation == generation; }
+        operator Asset*() { return slot->asset; }
+        operator const Asset*() const { return slot->asset; }
+        Asset* operator->() { return slot->asset; }
+        const Asset* operator->() const { return slot->asset; }
+        Asset& operator*() { return *slot->asset; }
+        const Asset& operator*() const { return *slot->asset; }
+        AssetId id() const { return slot->id; }
+
+        Slot* slot = nullptr;
+        uint32_t generation = 0;
+
+      private:
+        void acquire() {
+            if (slot)
+                slot->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        void release() {
+            if (slot)
+                slot->ref_count.fetch_sub(1, std::memory_order_acq_rel);
+        }
     };
 
     ~Library() {
-        for (auto a : assets)
-            unload(a.second->asset);
+        for (auto& slot : slots)
+            if (slot.asset)
+                unload(slot.asset);
+    }
+
+    Handle operator[](AssetId id) {
+        auto it = index.find(id);
+        if (it != index.end()) {
+            slots[it->second].last_used = tick;
+            return {&slots[it->second]};
+        }
+        PROFILE_ZONE("Library::load");
+        uint32_t i;
+        if (free_slots.empty()) {
+            i = slots.size();
+            slots.emplace_back();
+        } else {
+            i = free_slots.back();
+            free_slots.pop_back();
+        }
+        slots[i].id = id;
+        auto begin = Profiler::now();
+        slots[i].asset = load(asset_name(id));
+        log_asset_load(id, Profiler::now() - begin);
+        slots[i].size = size_of ? size_of(slots[i].asset) : 0;
+        slots[i].last_used = tick;
+        resident += slots[i].size;
+        index.emplace(id, i);
+        return {&slots[i]};
+    }
+
+    Handle operator[](std::string_view name) {
+        return (*this)[intern_asset(name)];
     }
 
-    Handle operator[](const std::string& name) {
-        auto it = assets.find(name);
-        if (it != assets.end())
-            return {it->second};
-        auto wrapper = assets[name] = new Wrapper;
-        wrapper->asset = load(name);
-        return {wrapper};
+    bool unused(const Slot& slot) const {
+        return slot.asset && !slot.pinned &&
+               slot.ref_count.load(std::memory_order_acquire) == 0;
     }
 
     void release_unused() {
-        std::vector<
-            typename std::unordered_map<std::string, Wrapper*>::iterator>
-            unused;
-        for (auto it = assets.begin(); it != assets.end(); ++it) {
-            if (it->second->ref_count == 0) {
-                unload(it->second->asset);
-                unused.push_back(it);
-            }
+        for (uint32_t i = 0; i < slots.size(); i++)
+            if (unused(slots[i]))
+                release(i);
+    }
+
+    // Advances the LRU clock, assets still referenced count as used
+    void touch() {
+        ++tick;
+        for (auto& slot : slots)
+            if (slot.asset && slot.ref_count.load(std::memory_order_relaxed))
+                slot.last_used = tick;
+    }
+
+    bool over_budget() const { return resident > budget; }
+
+    // Unloads up to max_count unused assets, least recently used first,
+    // until the library fits its budget. Unsized libraries whose assets hold
+    // other assets pass force to unload regardless, so those can go too.
+    size_t evict(size_t max_count, bool force = false) {
+        if ((!force && resident <= budget) || max_count == 0)
+            return 0;
+        std::vector<uint32_t> candidates;
+        for (uint32_t i = 0; i < slots.size(); i++)
+            if (unused(slots[i]))
+                candidates.push_back(i);
+        std::sort(candidates.begin(), candidates.end(), [this](auto a, auto b) {
+            return slots[a].last_used < slots[b].last_used;
+        });
+        size_t count = 0;
+        for (auto i : candidates) {
+            if ((!force && resident <= budget) || count == max_count)
+                break;
+            release(i);
+            ++count;
         }
-        for (auto it : unused)
-            assets.erase(it);
+        return count;
+    }
+
+    void release(uint32_t i) {
+        auto& slot = slots[i];
+        unload(slot.asset);
+        resident -= slot.size;
+        slot.asset = nullptr;
+        slot.size = 0;
+        slot.pinned = false;
+        ++slot.generation;
+        index.erase(slot.id);
+        free_slots.push_back(i);
     }
 
     std::function<Asset*(const std::string&)> load;
     std::function<void(Asset*)> unload;
+    std::function<size_t(const Asset*)> size_of;
+
+    size_t budget = SIZE_MAX;
+    size_t resident = 0;
+    uint64_t tick = 0;
 
-    std::unordered_map<std::string, Wrapper*> assets;
+    // Deque keeps slots in place, handles point straight at them
+    std::deque<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    std::unordered_map<AssetId, uint32_t> index;
 };
 
 namespace ozz {
@@ -87,25 +237,37 @@ using MeshHandle = Library<Mesh>::Handle;
 struct Model;
 using ModelHandle = Library<Model>::Handle;
 
+struct Prefab;
+using PrefabHandle = Library<Prefab>::Handle;
+
 using Shader = filament::Material;
 using ShaderHandle = Library<Shader>::Handle;
 
 using Skeleton = ozz::animation::Skeleton;
 using SkeletonHandle = Library<Skeleton>::Handle;
 
+struct Sound;
+using SoundHandle = Library<Sound>::Handle;
+
 struct Scripting;
 
 struct AssetLibrary {
     AssetLibrary(filament::Engine& engine);
 
+    AssetArchive archive;
+    // Dependencies before dependents, so dependents are destroyed first
+    Library<Shader> shaders;
     Library<Animation> animations;
+    Library<Skeleton> skeletons;
+    Library<Sound> sounds;
     Library<Mesh> meshes;
-    Library<Model> models;
-    Library<Shader> shaders;
     Library<Material> materials;
-    Library<Skeleton> skeletons;
+    Library<Model> models;
+    Library<Prefab> prefabs;
 
     void release_unused();
+    // Incremental eviction pass, unloads at most max_evictions assets
+    void update(size_t max_evictions = 4);
     void bind(Scripting& scripting);
 };
 
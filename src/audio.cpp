@@ -0,0 +1,171 @@
+#include "audio.h"
+#include "entity.h"
+#include "profiler.h"
+#include "scripting.h"
+#include "transform.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+Audio::Audio(bool headless) {
+    auto backend = headless ? SoLoud::Soloud::NULLDRIVER : SoLoud::Soloud::AUTO;
+    if (soloud.init(SoLoud::Soloud::CLIP_ROUNDOFF, backend) != SoLoud::SO_NO_ERROR) {
+        LOG_WARNING(logger(LogChannel::AUDIO), "No audio device, falling back to the NULL backend");
+        headless = true;
+        soloud.init(SoLoud::Soloud::CLIP_ROUNDOFF, SoLoud::Soloud::NULLDRIVER);
+    }
+    soloud.setMaxActiveVoiceCount(max_voices);
+    if (!headless)
+        return;
+    // The NULL backend never mixes by itself, streams would not advance
+    mixing = true;
+    mixer = std::thread([this]() {
+        auto samples = soloud.getBackendBufferSize();
+        std::vector<float> buffer(samples * soloud.getBackendChannels());
+        auto period = std::chrono::duration<double>(
+            double(samples) / soloud.getBackendSamplerate());
+        auto next = std::chrono::steady_clock::now();
+        while (mixing) {
+            soloud.mix(buffer.data(), samples);
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+            std::this_thread::sleep_until(next);
+        }
+    });
+}
+
+Audio::~Audio() {
+    mixing = false;
+    if (mixer.joinable())
+        mixer.join();
+    soloud.deinit();
+}
+
+SoLoud::handle Audio::play(Sound& sound, float volume) {
+    return soloud.play(*sound.source, volume * sound.volume);
+}
+
+void Audio::stop(SoLoud::handle voice) {
+    soloud.stop(voice);
+}
+
+void Audio::update(entt::registry& registry, float dt, Vec3f listener,
+                   Vec3f forward, Vec3f up) {
+    PROFILE_ZONE("Audio::update");
+    for (auto [entity, voice] : voices) {
+        auto emitter = registry.valid(entity)
+                           ? registry.try_get<AudioEmitter>(entity)
+                           : nullptr;
+        if (!emitter || emitter->voice != voice)
+            soloud.stop(voice);
+    }
+
+    candidates.clear();
+    for (auto [entity, emitter, transform] :
+         registry.view<AudioEmitter, Transform>().each()) {
+        if (emitter.voice && !soloud.isValidVoiceHandle(emitter.voice)) {
+            // Only one-shots run out, looping voices are never freed
+            emitter.voice = 0;
+            emitter.playing = false;
+        }
+        if (!emitter.playing || !emitter.sound) {
+            if (emitter.voice)
+                soloud.stop(emitter.voice);
+            emitter.voice = 0;
+            continue;
+        }
+        auto& sound = *emitter.sound;
+        if (!emitter.voice) {
+            emitter.time += dt;
+            if (sound.length > 0 && emitter.time >= sound.length) {
+                if (!sound.looping) {
+                    emitter.playing = false;
+                    continue;
+                }
+                emitter.time = std::fmod(emitter.time, sound.length);
+            }
+        }
+        float distance = length(transform.position - listener);
+        float score = 0;
+        if (distance <= sound.max_distance)
+            score = emitter.priority * emitter.volume * sound.volume *
+                    sound.min_distance / std::max(distance, sound.min_distance);
+        candidates.push_back({score, entity, &emitter, transform.position});
+    }
+
+    // Loudest first, everything past max_voices stays or goes virtual
+    auto real_end = candidates.begin() + std::min(max_voices, candidates.size());
+    std::nth_element(candidates.begin(), real_end, candidates.end(),
+                     [](auto& a, auto& b) { return a.score > b.score; });
+    for (auto it = real_end; it != candidates.end(); ++it)
+        if (it->emitter->voice) {
+            it->emitter->time = soloud.getStreamPosition(it->emitter->voice);
+            soloud.stop(it->emitter->voice);
+            it->emitter->voice = 0;
+        }
+
+    voices.clear();
+    for (auto it = candidates.begin(); it != real_end; ++it) {
+        auto& emitter = *it->emitter;
+        auto& position = it->position;
+        if (it->score <= 0) {
+            if (emitter.voice) {
+                emitter.time = soloud.getStreamPosition(emitter.voice);
+                soloud.stop(emitter.voice);
+                emitter.voice = 0;
+            }
+            continue;
+        }
+        auto& sound = *emitter.sound;
+        if (!emitter.voice) {
+            // Seeking a stream decodes it from the start up to the position,
+            // on this thread; streams start over instead, decoded sounds
+            // resume where they went virtual
+            if (sound.streamed)
+                emitter.time = 0;
+            emitter.voice = soloud.play3d(*sound.source, position.x, position.y,
+                                          position.z, 0, 0, 0,
+                                          emitter.volume * sound.volume, true);
+            if (emitter.time > 0)
+                soloud.seek(emitter.voice, emitter.time);
+            soloud.setPause(emitter.voice, false);
+        } else {
+            soloud.set3dSourcePosition(emitter.voice, position.x, position.y,
+                                       position.z);
+            soloud.setVolume(emitter.voice, emitter.volume * sound.volume);
+        }
+        voices.emplace_back(it->entity, emitter.voice);
+    }
+
+    soloud.set3dListenerParameters(listener.x, listener.y, listener.z,
+                                   forward.x, forward.y, forward.z,
+                                   up.x, up.y, up.z);
+    // Applies every voice's 3D parameters at once
+    soloud.update3dAudio();
+}
+
+void Audio::bind(Scripting& scripting, entt::registry& registry) {
+    auto& lua = scripting.lua;
+    lua.new_usertype<AudioEmitter>("AudioEmitter", "priority", &AudioEmitter::priority,
+                                   "volume", &AudioEmitter::volume, "playing", &AudioEmitter::playing);
+    lua["audio"] = lua.create_table();
+    lua["audio"]["add_emitter"] = [&registry](Entity entity, SoundHandle sound, sol::optional<float> priority) -> AudioEmitter& {
+        if (!sound)
+            throw sol::error("Invalid sound handle");
+        return registry.emplace_or_replace<AudioEmitter>(entity.id, std::move(sound), priority.value_or(1.0f));
+    };
+    lua["audio"]["emitter"] = [&registry](Entity entity) -> AudioEmitter& { return registry.get<AudioEmitter>(entity.id); };
+    lua["audio"]["remove_emitter"] = [&registry](Entity entity) { registry.remove<AudioEmitter>(entity.id); };
+    lua["audio"]["play"] = [this](SoundHandle sound, sol::optional<float> volume) {
+        if (!sound)
+            throw sol::error("Invalid sound handle");
+        return play(*sound, volume.value_or(1.0f));
+    };
+    lua["audio"]["stop"] = [this](SoLoud::handle voice) { stop(voice); };
+    lua["audio"]["set_max_voices"] = [this](size_t count) {
+        max_voices = count;
+        soloud.setMaxActiveVoiceCount(count);
+    };
+    lua["audio"]["voices"] = [this]() { return std::make_tuple(voices.size(), candidates.size()); };
+}
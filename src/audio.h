@@ -0,0 +1,77 @@
+#ifndef AUDIO_H_
+#define AUDIO_H_
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <entt/entt.hpp>
+#include <soloud.h>
+
+#include "asset_library.h"
+#include "primitives.h"
+
+struct Scripting;
+
+struct Sound {
+    // Backs the source, which decodes straight from it
+    AssetData data;
+    // Wav decoded up front, or WavStream decoded while mixing
+    std::unique_ptr<SoLoud::AudioSource> source;
+    bool streamed = false;
+    bool looping = false;
+    double length = 0;
+    float volume = 1;
+    float min_distance = 1;
+    // Farther away the sound is inaudible and never takes a voice
+    float max_distance = 64;
+};
+
+// Positional sound source, placed by the entity's Transform
+struct AudioEmitter {
+    SoundHandle sound;
+    float priority = 1;
+    float volume = 1;
+    bool playing = true;
+    // Real voice, 0 while virtual
+    SoLoud::handle voice = 0;
+    // Seconds into the sound, kept up to date while virtual
+    double time = 0;
+};
+
+// Maps any number of emitters onto at most max_voices real voices, picking
+// the loudest by priority, volume and distance every frame. Virtual emitters
+// only advance their time, so they cost no mixing and no calls into SoLoud.
+// Decoded sounds resume at that time, streamed ones restart.
+// Headless instances run on the NULL backend with a mixing thread standing in
+// for the audio device.
+struct Audio {
+    Audio(bool headless = false);
+    ~Audio();
+
+    void update(entt::registry& registry, float dt, Vec3f listener,
+                Vec3f forward, Vec3f up);
+    // Non-positional, for music and UI, bypasses virtualization
+    SoLoud::handle play(Sound& sound, float volume = 1);
+    void stop(SoLoud::handle voice);
+
+    void bind(Scripting& scripting, entt::registry& registry);
+
+    struct Candidate {
+        float score;
+        entt::entity entity;
+        AudioEmitter* emitter;
+        Vec3f position;
+    };
+
+    SoLoud::Soloud soloud;
+    size_t max_voices = 32;
+    std::vector<Candidate> candidates;
+    // Voices started by update, checked each frame so that removed emitters
+    // are silenced without hooking the registry, which dies first
+    std::vector<std::pair<entt::entity, SoLoud::handle>> voices;
+
+    std::atomic<bool> mixing = false;
+    std::thread mixer;
+};
+
+#endif // AUDIO_H_
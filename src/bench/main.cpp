@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <entt/entt.hpp>
+#undef Success // X11 defines this
+#include "../graphics.h"
+#undef assert_invariant
+#include <nlohmann/json.hpp>
+
+#include "../animator.h"
+#include "../audio.h"
+#include "../entity.h"
+#include "../log.h"
+#include "../memory.h"
+#include "../prefab.h"
+#include "../profiler.h"
+#include "../scripting.h"
+#include "../snapshot.h"
+#include "../spatial_index.h"
+#include "../transform.h"
+
+static std::atomic<size_t> allocation_count = 0;
+
+void* operator new(size_t size) {
+    ++allocation_count;
+    if (auto ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+struct Settings {
+    size_t foxes = 100;
+    size_t props = 100;
+    size_t scripted = 100;
+    size_t frames = 500;
+    size_t warmup = 20;
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    std::string scene = "assets/bench/stress.lua";
+    std::string output;
+    std::string save_snapshot;
+};
+
+[[noreturn]] static void usage(const char* program, const std::string& error) {
+    std::cerr << error << std::endl
+              << "Usage: " << program
+              << " [--foxes N] [--props N] [--scripted N] [--frames N] [--warmup N]"
+                 " [--width N] [--height N] [--scene PATH] [--output PATH]"
+                 " [--save-snapshot PATH]"
+              << std::endl;
+    std::exit(1);
+}
+
+static Settings parse_args(int argc, char* argv[]) {
+    Settings settings;
+    for (int i = 1; i < argc; i += 2) {
+        std::string arg = argv[i];
+        if (i + 1 == argc)
+            usage(argv[0], "Missing value for '" + arg + "'");
+        std::string value = argv[i + 1];
+        auto number = [&]() -> unsigned long {
+            try {
+                size_t end = 0;
+                auto n = std::stoul(value, &end);
+                if (end == value.size())
+                    return n;
+            } catch (const std::exception&) {
+            }
+            usage(argv[0], "Expected a number for '" + arg + "', got '" + value + "'");
+        };
+        if (arg == "--foxes")
+            settings.foxes = number();
+        else if (arg == "--props")
+            settings.props = number();
+        else if (arg == "--scripted")
+            settings.scripted = number();
+        else if (arg == "--frames")
+            settings.frames = number();
+        else if (arg == "--warmup")
+            settings.warmup = number();
+        else if (arg == "--width")
+            settings.width = number();
+        else if (arg == "--height")
+            settings.height = number();
+        else if (arg == "--scene")
+            settings.scene = value;
+        else if (arg == "--output")
+            settings.output = value;
+        else if (arg == "--save-snapshot")
+            settings.save_snapshot = value;
+        else
+            usage(argv[0], "Unknown argument '" + arg + "'");
+    }
+    return settings;
+}
+
+struct Timings {
+    std::vector<float> milliseconds;
+    std::vector<size_t> allocations;
+};
+
+static nlohmann::json summarize(Timings& timings) {
+    auto& ms = timings.milliseconds;
+    auto sorted = ms;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](float p) {
+        return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+    };
+    double total = 0;
+    for (auto t : ms)
+        total += t;
+    size_t total_allocations = 0, max_allocations = 0;
+    for (auto a : timings.allocations) {
+        total_allocations += a;
+        max_allocations = std::max(max_allocations, a);
+    }
+    return {{"mean_ms", total / ms.size()},
+            {"min_ms", sorted.front()},
+            {"p50_ms", percentile(0.5f)},
+            {"p90_ms", percentile(0.9f)},
+            {"p99_ms", percentile(0.99f)},
+            {"max_ms", sorted.back()},
+            {"allocations_per_frame", double(total_allocations) / ms.size()},
+            {"max_allocations_per_frame", max_allocations}};
+}
+
+int main(int argc, char* argv[]) {
+    auto settings = parse_args(argc, argv);
+    if (settings.frames == 0) {
+        std::cerr << "At least one frame is required" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    nlohmann::json report;
+    report["settings"] = {{"foxes", settings.foxes},
+                          {"props", settings.props},
+                          {"scripted", settings.scripted},
+                          {"frames", settings.frames},
+                          {"warmup", settings.warmup},
+                          {"scene", settings.scene}};
+    {
+        Graphics graphics(settings.width, settings.height);
+        Audio audio(true);
+        AssetLibrary assets(*graphics.engine);
+        entt::registry registry;
+        graphics.track_renderables(registry);
+        Scripting scripting;
+        Animator animator;
+        SpatialIndex spatial(registry);
+
+        Entity::bind(scripting, registry);
+        Transform::bind(scripting);
+        assets.bind(scripting);
+        graphics.bind(scripting);
+        animator.bind(scripting);
+        Prefab::bind(scripting, registry, graphics);
+        Snapshot::bind(scripting, registry, graphics, assets);
+        spatial.bind(scripting, graphics);
+        audio.bind(scripting, registry);
+        Profiler::get().bind(scripting);
+        Log::get().bind(scripting);
+
+        auto load_start = std::chrono::high_resolution_clock::now();
+        auto load_allocations = allocation_count.load();
+        scripting.lua["bench"] = scripting.lua.create_table_with(
+            "foxes", settings.foxes, "props", settings.props, "scripted",
+            settings.scripted);
+        // Snapshots stand in for the scene script to compare load times
+        if (std::filesystem::path(settings.scene).extension() == ".snap") {
+            std::ifstream file(settings.scene, std::ios::binary);
+            Snapshot snapshot;
+            if (!file || !snapshot.read(file))
+                return EXIT_FAILURE;
+            snapshot.instantiate(registry, graphics, assets);
+        } else {
+            scripting.lua.script_file(settings.scene);
+        }
+        sol::protected_function bench_update = scripting.lua["bench_update"];
+        report["load"] = {
+            {"ms", std::chrono::duration<float, std::milli>(
+                       std::chrono::high_resolution_clock::now() - load_start)
+                       .count()},
+            {"allocations", allocation_count.load() - load_allocations},
+            {"entities", registry.view<Transform>().size()}};
+        if (!settings.save_snapshot.empty()) {
+            std::ofstream file(settings.save_snapshot, std::ios::binary);
+            Snapshot::capture(registry).write(file);
+        }
+
+        auto sun = registry.create();
+        registry.emplace<Sun>(sun, graphics);
+        graphics.create_view();
+
+        const char* systems[] = {"scripts", "animation", "skinning",
+                                 "transforms", "spatial", "audio", "gc", "assets", "render",
+                                 "frame"};
+        std::unordered_map<std::string, Timings> timings;
+        const float dt = 1.0f / 60;
+        std::string script_error;
+        for (size_t frame = 0; frame < settings.warmup + settings.frames; frame++) {
+            bool measured = frame >= settings.warmup;
+            auto frame_start = std::chrono::high_resolution_clock::now();
+            auto frame_allocations = allocation_count.load();
+            auto measure = [&](const char* name, auto&& system) {
+                auto start = std::chrono::high_resolution_clock::now();
+                auto allocations = allocation_count.load();
+                system();
+                if (!measured)
+                    return;
+                auto& t = timings[name];
+                t.milliseconds.push_back(
+                    std::chrono::duration<float, std::milli>(
+                        std::chrono::high_resolution_clock::now() - start)
+                        .count());
+                t.allocations.push_back(allocation_count.load() - allocations);
+            };
+            measure("scripts", [&] {
+                if (!bench_update.valid())
+                    return;
+                sol::protected_function_result result = bench_update(dt);
+                if (!result.valid())
+                    script_error = result.get<sol::error>().what();
+            });
+            // Timings of a frame whose script failed would not be comparable
+            if (!script_error.empty())
+                break;
+            measure("animation", [&] { animator.update(dt, registry); });
+            measure("skinning", [&] { animator.update_renderables(registry, graphics); });
+            measure("transforms", [&] {
+                graphics.sort_renderables(registry);
+                Transform::propagate_transforms(registry, graphics);
+            });
+            measure("spatial", [&] { spatial.update(); });
+            measure("audio", [&] { audio.update(registry, dt, {0, 0, 0}, {0, 0, -1}, {0, 1, 0}); });
+            measure("gc", [&] { scripting.step_gc(); });
+            measure("assets", [&] { assets.update(); });
+            measure("render", [&] { graphics.render([] {}); });
+            MemoryTracker::get().sample(registry, assets);
+            Profiler::get().end_frame();
+            MemoryTracker::get().end_frame();
+            if (measured) {
+                auto& t = timings["frame"];
+                t.milliseconds.push_back(
+                    std::chrono::duration<float, std::milli>(
+                        std::chrono::high_resolution_clock::now() - frame_start)
+                        .count());
+                t.allocations.push_back(allocation_count.load() - frame_allocations);
+            }
+        }
+        if (!script_error.empty()) {
+            std::cerr << "bench_update failed: " << script_error << std::endl;
+            registry.clear();
+            return EXIT_FAILURE;
+        }
+        for (auto name : systems)
+            report["systems"][name] = summarize(timings[name]);
+        report["lua_heap_bytes"] = scripting.gc_stats.heap_size;
+        report["memory"] = MemoryTracker::get().json();
+        // Fires the on_destroy hooks while the systems behind them still exist
+        registry.clear();
+    }
+
+    if (settings.output.empty()) {
+        std::cout << report.dump(4) << std::endl;
+    } else {
+        std::ofstream file(settings.output);
+        file << report.dump(4) << std::endl;
+    }
+    Log::get().flush();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+
+#include "../asset_archive.h"
+#include "../asset_library.h"
+
+// Bundles an asset directory into a single archive:
+//   Mercury-cook <assets dir> <output.pak> [--compress] [--strip-scripts]
+// Stripped archives ship the bytecode cached under cache/scripts instead of
+// the Lua sources, so the engine must have run the scripts once.
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <assets dir> <output.pak> [--compress] [--strip-scripts]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::filesystem::path root = argv[1];
+    std::string output = argv[2];
+    bool compress = false, strip_scripts = false;
+    for (int i = 3; i < argc; i++) {
+        compress |= std::string(argv[i]) == "--compress";
+        strip_scripts |= std::string(argv[i]) == "--strip-scripts";
+    }
+
+    std::vector<std::string> paths;
+    for (auto& p : std::filesystem::recursive_directory_iterator(root)) {
+        if (!p.is_regular_file())
+            continue;
+        auto path = std::filesystem::relative(p.path(), root).generic_string();
+        if (strip_scripts && (path.starts_with("scripts/") || path.starts_with("shards/")))
+            continue;
+        // Local build caches stay out, except the bytecode stripped archives
+        // run and the ozz imports, which are looked up through the archive
+        if (path.starts_with("cache/") && !path.starts_with("cache/scripts/") &&
+            !path.starts_with("cache/ozz/"))
+            continue;
+        paths.push_back(path);
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::ofstream file(output, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open '" << output << "'." << std::endl;
+        return EXIT_FAILURE;
+    }
+    PakHeader header;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    auto pad = [&]() {
+        auto position = uint64_t(file.tellp());
+        auto aligned = (position + header.alignment - 1) / header.alignment *
+                       header.alignment;
+        std::fill_n(std::ostreambuf_iterator<char>(file), aligned - position, 0);
+        return aligned;
+    };
+
+    std::vector<PakEntry> entries;
+    std::unordered_map<uint64_t, std::string> hashes;
+    std::string names;
+    size_t total_size = 0, total_stored = 0;
+    for (auto& path : paths) {
+        auto hash = hash_name(path);
+        if (auto [it, inserted] = hashes.emplace(hash, path); !inserted) {
+            std::cerr << "Hash collision between '" << path << "' and '"
+                      << it->second << "'." << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::ifstream input(root / path, std::ios::binary);
+        std::vector<char> data{std::istreambuf_iterator<char>(input),
+                               std::istreambuf_iterator<char>()};
+        PakEntry entry{hash, pad(), data.size(), data.size(), PakCodec::NONE,
+                       uint32_t(names.size())};
+        if (compress && !data.empty()) {
+            uLongf size = compressBound(data.size());
+            std::vector<char> compressed(size);
+            if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &size,
+                          reinterpret_cast<const Bytef*>(data.data()),
+                          data.size(), Z_BEST_COMPRESSION) == Z_OK &&
+                size < data.size() * 9 / 10) {
+                compressed.resize(size);
+                data = std::move(compressed);
+                entry.codec = PakCodec::ZLIB;
+                entry.stored_size = size;
+            }
+        }
+        file.write(data.data(), data.size());
+        names += path;
+        names += '\0';
+        total_size += entry.size;
+        total_stored += entry.stored_size;
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](auto& a, auto& b) { return a.hash < b.hash; });
+
+    header.names_offset = file.tellp();
+    file.write(names.data(), names.size());
+    header.toc_offset = pad();
+    header.entry_count = entries.size();
+    file.write(reinterpret_cast<const char*>(entries.data()),
+               entries.size() * sizeof(PakEntry));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!file) {
+        std::cerr << "Failed to write '" << output << "'." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Cooked " << entries.size() << " assets, " << total_size
+              << " bytes stored as " << total_stored << std::endl;
+    return EXIT_SUCCESS;
+}
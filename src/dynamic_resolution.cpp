@@ -0,0 +1,31 @@
+#include "dynamic_resolution.h"
+#include "scripting.h"
+
+#include <algorithm>
+#include <cmath>
+
+float DynamicResolution::update(float frame_time) {
+    average = average > 0 ? average + smoothing * (frame_time - average)
+                          : frame_time;
+    if (average > target_frame_time * (1 + tolerance) ||
+        average < target_frame_time * (1 - tolerance)) {
+        // Render cost goes with the pixel count, the square of the scale
+        float wanted = scale * std::sqrt(target_frame_time / average);
+        scale += std::clamp(wanted - scale, -max_step, max_step);
+    }
+    scale = std::clamp(scale, min_scale, max_scale);
+    return scale;
+}
+
+void DynamicResolution::bind(Scripting& scripting) {
+    auto& lua = scripting.lua;
+    lua["resolution"] = lua.create_table();
+    lua["resolution"]["set_target"] = [this](float seconds) { target_frame_time = seconds; };
+    lua["resolution"]["set_bounds"] = [this](float min, float max) {
+        if (min <= 0 || max < min)
+            throw sol::error("Invalid resolution scale bounds");
+        min_scale = min;
+        max_scale = max;
+    };
+    lua["resolution"]["scale"] = [this]() { return scale; };
+}
@@ -0,0 +1,32 @@
+#ifndef DYNAMIC_RESOLUTION_H_
+#define DYNAMIC_RESOLUTION_H_
+
+struct Scripting;
+
+// Picks the resolution scale from measured frame times. It only does
+// arithmetic on the timings it is fed, so synthetic timings exercise it the
+// same way real frames do.
+struct DynamicResolution {
+    // Takes the seconds a frame spent simulating and rendering, excluding
+    // any sleep or vsync wait, and returns the scale to render the next
+    // frame at
+    float update(float frame_time);
+
+    void bind(Scripting& scripting);
+
+    float target_frame_time = 1.0f / 60;
+    // Averages within this fraction of the target leave the scale alone,
+    // so a frame bound by vsync does not count as slow
+    float tolerance = 0.1f;
+    float min_scale = 0.5f;
+    float max_scale = 1;
+    // Weight of the newest frame in the moving average
+    float smoothing = 0.1f;
+    // Largest change of scale per frame
+    float max_step = 0.05f;
+
+    float scale = 1;
+    float average = 0;
+};
+
+#endif // DYNAMIC_RESOLUTION_H_
@@ -0,0 +1,32 @@
+#include "entity.h"
+#include "animator.h"
+#include "graphics.h"
+#include "scripting.h"
+#include "transform.h"
+
+void Entity::bind(Scripting& scripting, entt::registry& registry) {
+    scripting.lua.new_usertype<Entity>("Entity",
+        sol::meta_function::construct, [&registry]() { return Entity{ registry.create() }; },
+        "add", sol::overload(
+            // TODO: automate this
+            [&registry](Entity entity, Transform& component) -> Transform& { return registry.emplace<Transform>(entity.id, component); },
+            // Move-only, the script's value is left without an instance. The
+            // returned reference only lasts until Graphics::sort_renderables
+            // reorders the storage, look it up again with Entity:renderable
+            [&registry](Entity entity, Renderable& component) -> Renderable& {
+                if (!component.instance)
+                    throw sol::error("Renderable already added to an entity");
+                return registry.emplace<Renderable>(entity.id, std::move(component));
+            },
+            [&registry](Entity entity, Sun& component) -> Sun& { return registry.emplace<Sun>(entity.id, component); },
+            [&registry](Entity entity, DirectionalLight& component) -> DirectionalLight& { return registry.emplace<DirectionalLight>(entity.id, component); },
+            // Move-only, the script's value is left without a pose
+            [&registry](Entity entity, SkeletalAnimation& component) -> SkeletalAnimation& {
+                if (component.pose == PosePool::none)
+                    throw sol::error("SkeletalAnimation already added to an entity");
+                return registry.emplace<SkeletalAnimation>(entity.id, std::move(component));
+            }
+        ),
+        "transform", [&registry](Entity entity) -> Transform& { return registry.get<Transform>(entity.id); },
+        "renderable", [&registry](Entity entity) -> Renderable& { return registry.get<Renderable>(entity.id); });
+}
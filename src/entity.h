@@ -0,0 +1,13 @@
+#ifndef ENTITY_H_
+#define ENTITY_H_
+#include <entt/entt.hpp>
+
+struct Scripting;
+
+struct Entity {
+    entt::registry::entity_type id;
+
+    static void bind(Scripting& scripting, entt::registry& registry);
+};
+
+#endif // ENTITY_H_
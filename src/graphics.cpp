@@ -7,25 +7,103 @@
 #include "filament/LightManager.h"
 #include "filament/RenderableManager.h"
 #include "material.h"
+#include "memory.h"
 #include "math/TVecHelpers.h"
 #include "math/norm.h"
 #include "mesh.h"
 #include "model.h"
+#include "profiler.h"
 #include "scripting.h"
 
-Renderable::Renderable(Graphics& graphics, ModelHandle model) {
-    auto builder =
-        filament::RenderableManager::Builder(model->mesh->parts.size());
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+
+static filament::RenderableManager::Builder
+renderable_builder(const Model& model, filament::MaterialInstance* instance) {
+    auto builder = filament::RenderableManager::Builder(model.mesh->parts.size());
     builder.boundingBox({{0, 0, 0}, {1, 1, 1}});
-    for (size_t i = 0; i < model->mesh->parts.size(); i++) {
-        auto& part = model->mesh->parts[i];
-        builder.material(i, model->material->instance)
+    for (size_t i = 0; i < model.mesh->parts.size(); i++) {
+        auto& part = model.mesh->parts[i];
+        builder.material(i, instance)
             .geometry(i, filament::RenderableManager::PrimitiveType::TRIANGLES,
                       part.vertex_buffer, part.index_buffer);
     }
+    builder.skinning(model.mesh->inverse_binds.size());
+    return builder;
+}
+
+Renderable::Renderable(Graphics& _graphics, ModelHandle _model,
+                       const MaterialOverrides& _overrides)
+    : graphics(&_graphics), model(_model), overrides(_overrides) {
+    instance = model->material->acquire(overrides);
     entity = utils::EntityManager::get().create();
-    builder.skinning(model->mesh->inverse_binds.size()).build(*graphics.engine, entity);
-    graphics.scene->addEntity(entity);
+    renderable_builder(*model, instance).build(*graphics->engine, entity);
+    graphics->scene->addEntity(entity);
+    graphics->renderables_dirty = true;
+}
+
+Renderable::Renderable(Renderable&& other) noexcept
+    : graphics(other.graphics), entity(std::exchange(other.entity, {})),
+      model(std::move(other.model)),
+      overrides(std::move(other.overrides)),
+      instance(std::exchange(other.instance, nullptr)) {}
+
+Renderable& Renderable::operator=(Renderable&& other) noexcept {
+    if (this == &other)
+        return *this;
+    // registry.replace assigns over a live component without on_destroy
+    release();
+    graphics = other.graphics;
+    entity = std::exchange(other.entity, {});
+    model = std::move(other.model);
+    overrides = std::move(other.overrides);
+    instance = std::exchange(other.instance, nullptr);
+    return *this;
+}
+
+Renderable::Renderable(Graphics& _graphics, utils::Entity _entity,
+                       ModelHandle _model)
+    : graphics(&_graphics), entity(_entity), model(_model) {
+    // Counted like any other user, the batch was built with this instance
+    instance = model->material->acquire(overrides);
+}
+
+std::vector<utils::Entity> Graphics::create_renderables(const Model& model,
+                                                        size_t count) {
+    std::vector<utils::Entity> entities(count);
+    utils::EntityManager::get().create(count, entities.data());
+    auto builder = renderable_builder(model, model.material->instance);
+    for (auto entity : entities)
+        builder.build(*engine, entity);
+    scene->addEntities(entities.data(), count);
+    renderables_dirty = true;
+    return entities;
+}
+
+void Renderable::release() {
+    if (!instance)
+        return;
+    graphics->scene->remove(entity);
+    graphics->engine->destroy(entity);
+    utils::EntityManager::get().destroy(entity);
+    model->material->release(*graphics->engine, instance);
+    entity = {};
+    instance = nullptr;
+}
+
+void Renderable::set_parameter(Graphics& graphics, std::string_view name,
+                               Vec4f value, uint8_t components) {
+    overrides.set(name, value, components);
+    auto previous = instance;
+    instance = model->material->acquire(overrides);
+    model->material->release(*graphics.engine, previous);
+    auto& renderable_manager = graphics.engine->getRenderableManager();
+    auto renderable_instance = renderable_manager.getInstance(entity);
+    for (size_t i = 0; i < renderable_manager.getPrimitiveCount(renderable_instance); i++)
+        renderable_manager.setMaterialInstanceAt(renderable_instance, i, instance);
+    graphics.renderables_dirty = true;
 }
 
 Sun::Sun(Graphics& graphics) {
@@ -77,6 +155,15 @@ Graphics::Graphics(GLFWwindow* win, ImGuiContext* imgui_context) {
         {.clearColor = {0.6f, 0.8f, 1.0f, 1.0f}, .clear = true});
 }
 
+Graphics::Graphics(uint32_t width, uint32_t height) {
+    engine = filament::Engine::create(filament::backend::Backend::NOOP);
+    swap_chain = engine->createSwapChain(width, height);
+    renderer = engine->createRenderer();
+    scene = engine->createScene();
+    ui_view = engine->createView();
+    ui_view->setViewport({0, 0, width, height});
+}
+
 filament::View* Graphics::create_view() {
     const auto size = ui_view->getViewport();
     auto cam = engine->createCamera(utils::EntityManager::get().create());
@@ -92,35 +179,56 @@ filament::View* Graphics::create_view() {
     return view;
 }
 
+static OffscreenTarget create_offscreen_target(filament::Engine& engine,
+                                               uint32_t width, uint32_t height) {
+    auto color = filament::Texture::Builder()
+                     .width(width)
+                     .height(height)
+                     .levels(1)
+                     .usage(filament::Texture::Usage::COLOR_ATTACHMENT |
+                            filament::Texture::Usage::SAMPLEABLE)
+                     .format(filament::Texture::InternalFormat::RGBA8)
+                     .build(engine);
+    auto depth = filament::Texture::Builder()
+                     .width(width)
+                     .height(height)
+                     .levels(1)
+                     .usage(filament::Texture::Usage::DEPTH_ATTACHMENT)
+                     .format(filament::Texture::InternalFormat::DEPTH24)
+                     .build(engine);
+    auto target =
+        filament::RenderTarget::Builder()
+            .texture(filament::RenderTarget::AttachmentPoint::COLOR, color)
+            .texture(filament::RenderTarget::AttachmentPoint::DEPTH, depth)
+            .build(engine);
+    // RGBA8 and DEPTH24, which drivers pad to 32 bits
+    size_t size = size_t(width) * height * 8;
+    MemoryTracker::get().allocate(MemoryTag::GRAPHICS, size);
+    return {target, color, depth, size};
+}
+
+static void set_offscreen_bucket(filament::Engine& engine, filament::View* view,
+                                 OffscreenView& offscreen, uint32_t bucket) {
+    uint32_t width = std::max(1u, offscreen.width * bucket / Graphics::resolution_buckets);
+    uint32_t height = std::max(1u, offscreen.height * bucket / Graphics::resolution_buckets);
+    auto it = offscreen.targets.find(bucket);
+    if (it == offscreen.targets.end())
+        it = offscreen.targets.emplace(bucket, create_offscreen_target(engine, width, height)).first;
+    offscreen.bucket = bucket;
+    view->setRenderTarget(it->second.target);
+    view->setViewport({0, 0, width, height});
+}
+
 std::tuple<filament::View*, filament::Texture*>
 Graphics::create_offscreen_view(uint32_t width, uint32_t height) {
     auto view = engine->createView();
     view->setScene(scene);
     view->setPostProcessingEnabled(false);
-    auto colorTexture = filament::Texture::Builder()
-                            .width(width)
-                            .height(height)
-                            .levels(1)
-                            .usage(filament::Texture::Usage::COLOR_ATTACHMENT |
-                                   filament::Texture::Usage::SAMPLEABLE)
-                            .format(filament::Texture::InternalFormat::RGBA8)
-                            .build(*engine);
-    auto depthTexture = filament::Texture::Builder()
-                            .width(width)
-                            .height(height)
-                            .levels(1)
-                            .usage(filament::Texture::Usage::DEPTH_ATTACHMENT)
-                            .format(filament::Texture::InternalFormat::DEPTH24)
-                            .build(*engine);
-    auto renderTarget =
-        filament::RenderTarget::Builder()
-            .texture(filament::RenderTarget::AttachmentPoint::COLOR,
-                     colorTexture)
-            .texture(filament::RenderTarget::AttachmentPoint::DEPTH,
-                     depthTexture)
-            .build(*engine);
-    view->setRenderTarget(renderTarget);
-    view->setViewport({0, 0, width, height});
+    auto& offscreen = offscreen_targets.emplace_back();
+    offscreen.width = width;
+    offscreen.height = height;
+    set_offscreen_bucket(*engine, view, offscreen,
+                         std::ceil(resolution_scale * resolution_buckets));
     auto camera = engine->createCamera(utils::EntityManager::get().create());
     camera->setExposure(16.0f, 1 / 125.0f, 100.0f);
     camera->setExposure(100.0f);
@@ -128,10 +236,28 @@ Graphics::create_offscreen_view(uint32_t width, uint32_t height) {
     camera->lookAt({0, 0, 10}, {0, 0, 0}, {0, 1, 0});
     view->setCamera(camera);
     offscreen_views.push_back(view);
-    offscreen_targets.push_back(renderTarget);
-    textures.push_back(colorTexture);
-    textures.push_back(depthTexture);
-    return {view, colorTexture};
+    return {view, offscreen_texture(view)};
+}
+
+filament::Texture* Graphics::offscreen_texture(const filament::View* view) const {
+    auto i = std::find(offscreen_views.begin(), offscreen_views.end(), view) -
+             offscreen_views.begin();
+    auto& offscreen = offscreen_targets[i];
+    return offscreen.targets.at(offscreen.bucket).color;
+}
+
+void Graphics::set_resolution_scale(float scale) {
+    uint32_t bucket = std::max(1.0f, std::ceil(scale * resolution_buckets));
+    resolution_scale = float(bucket) / resolution_buckets;
+    for (size_t i = 0; i < offscreen_views.size(); i++)
+        if (offscreen_targets[i].bucket != bucket)
+            set_offscreen_bucket(*engine, offscreen_views[i], offscreen_targets[i], bucket);
+    filament::View::DynamicResolutionOptions options;
+    options.minScale = filament::math::float2(resolution_scale);
+    options.maxScale = filament::math::float2(resolution_scale);
+    options.enabled = resolution_scale != 1;
+    for (auto view : views)
+        view->setDynamicResolutionOptions(options);
 }
 
 utils::Entity Graphics::create_entity(ModelHandle model) {
@@ -150,19 +276,63 @@ utils::Entity Graphics::create_entity(ModelHandle model) {
     return entity;
 }
 
+void Graphics::sort_renderables(entt::registry& registry) {
+    // Filament batches draws by instance itself, this keeps our own
+    // per-renderable passes walking instances in the same order
+    if (!renderables_dirty)
+        return;
+    registry.sort<Renderable>([](const auto& a, const auto& b) { return a.instance < b.instance; });
+    renderables_dirty = false;
+}
+
+void Graphics::track_renderables(entt::registry& registry) {
+    registry.on_destroy<Renderable>().connect<&Graphics::destroy_renderable>(*this);
+}
+
+void Graphics::destroy_renderable(entt::registry& registry, entt::entity entity) {
+    registry.get<Renderable>(entity).release();
+}
+
 void Graphics::render(std::function<void()> imgui_cmds) {
+    PROFILE_ZONE("Graphics::render");
     if (renderer->beginFrame(swap_chain)) {
         for (auto view : offscreen_views)
             renderer->render(view);
-        imgui_helper->render(0.016, [imgui_cmds](auto, auto) { imgui_cmds(); });
+        if (imgui_helper)
+            imgui_helper->render(0.016, [imgui_cmds](auto, auto) { imgui_cmds(); });
         for (auto view : views)
             renderer->render(view);
-        renderer->render(ui_view);
+        if (imgui_helper)
+            renderer->render(ui_view);
         renderer->endFrame();
     }
 }
 
+void Graphics::upload_bones(const std::vector<filament::math::mat4f>& bones) {
+    if (bones.size() > skinning_capacity) {
+        if (skinning_buffer) {
+            engine->destroy(skinning_buffer);
+            MemoryTracker::get().free(MemoryTag::GRAPHICS, skinning_capacity * sizeof(filament::math::mat4f));
+        }
+        skinning_capacity = std::max<size_t>(256, skinning_capacity);
+        while (skinning_capacity < bones.size())
+            skinning_capacity *= 2;
+        skinning_buffer = filament::SkinningBuffer::Builder()
+                              .boneCount(skinning_capacity)
+                              .initialize(false)
+                              .build(*engine);
+        ++skinning_generation;
+        MemoryTracker::get().allocate(MemoryTag::GRAPHICS, skinning_capacity * sizeof(filament::math::mat4f));
+    }
+    if (!bones.empty())
+        skinning_buffer->setBones(*engine, bones.data(), bones.size());
+}
+
 Graphics::~Graphics() {
+    if (skinning_buffer) {
+        engine->destroy(skinning_buffer);
+        MemoryTracker::get().free(MemoryTag::GRAPHICS, skinning_capacity * sizeof(filament::math::mat4f));
+    }
     for (auto view : views)
         engine->destroy(view->getCamera().getEntity());
     for (auto view : views)
@@ -171,10 +341,13 @@ Graphics::~Graphics() {
         engine->destroy(view->getCamera().getEntity());
     for (auto view : offscreen_views)
         engine->destroy(view);
-    for (auto target : offscreen_targets)
-        engine->destroy(target);
-    for (auto texture : textures)
-        engine->destroy(texture);
+    for (auto& offscreen : offscreen_targets)
+        for (auto& [bucket, target] : offscreen.targets) {
+            engine->destroy(target.target);
+            engine->destroy(target.color);
+            engine->destroy(target.depth);
+            MemoryTracker::get().free(MemoryTag::GRAPHICS, target.size);
+        }
     engine->destroy(ui_view);
     engine->destroy(scene);
     engine->destroy(renderer);
@@ -185,7 +358,26 @@ Graphics::~Graphics() {
 
 void Graphics::bind(Scripting& scripting) {
     auto& lua = scripting.lua;
-    lua.new_usertype<Renderable>("Renderable", sol::meta_function::construct, [this](ModelHandle model) { return Renderable(*this, model); });
+    // Checked here, Filament would abort on an unknown name
+    auto set = [this](Renderable& renderable, std::string_view name, Vec4f value,
+                      uint8_t components) {
+        auto& parameters = renderable.model->material->parameters;
+        auto parameter = std::find_if(parameters.begin(), parameters.end(),
+                                      [id = AssetId(name)](auto& p) { return p.name == id; });
+        if (parameter == parameters.end())
+            throw sol::error("Material has no parameter '" + std::string(name) + "'");
+        if (parameter->components != components)
+            throw sol::error("Parameter '" + std::string(name) + "' takes " +
+                             std::to_string(parameter->components) + " components");
+        renderable.set_parameter(*this, name, value, components);
+    };
+    lua.new_usertype<Renderable>("Renderable", sol::meta_function::construct, [this](ModelHandle model) { return Renderable(*this, model); },
+        "set_parameter", sol::overload(
+            [set](Renderable& renderable, std::string_view name, float value) { set(renderable, name, {value, 0, 0, 0}, 1); },
+            [set](Renderable& renderable, std::string_view name, Vec2f value) { set(renderable, name, {value.x, value.y, 0, 0}, 2); },
+            [set](Renderable& renderable, std::string_view name, Vec3f value) { set(renderable, name, {value, 0}, 3); },
+            [set](Renderable& renderable, std::string_view name, Vec4f value) { set(renderable, name, value, 4); }
+        ));
     lua.new_usertype<Sun>("Sun", sol::meta_function::construct, [this](ModelHandle model) { return Sun(*this); });
     lua.new_usertype<DirectionalLight>("DirectionalLight", sol::meta_function::construct, [this](ModelHandle model) { return DirectionalLight(*this); });
 }
@@ -1,3 +1,5 @@
+#ifndef GRAPHICS_H_
+#define GRAPHICS_H_
 #include "filament/RenderableManager.h"
 #if defined(__linux)
 #define GLFW_EXPOSE_NATIVE_X11
@@ -16,6 +18,7 @@
 #include <filament/Engine.h>
 #include <filament/Renderer.h>
 #include <filament/Scene.h>
+#include <filament/SkinningBuffer.h>
 #include <filament/SwapChain.h>
 #include <filament/TransformManager.h>
 #include <filament/View.h>
@@ -23,19 +26,45 @@
 #include <filameshio/MeshReader.h>
 #include <memory>
 #include <sstream>
+#include <unordered_map>
 #include <stdio.h>
 #include <stdlib.h>
 #include <utils/EntityManager.h>
 #include <utils/Path.h>
+#include <entt/entt.hpp>
 
 #include "asset_library.h"
+#include "material.h"
 
 struct Graphics;
 
+// Holds one reference on its material instance. Move-only, a copy would
+// share the reference without counting it; the registry's on_destroy hook,
+// see Graphics::track_renderables, destroys the entity and releases it, and
+// so does assigning another renderable over it.
 struct Renderable {
-    Renderable(Graphics& graphics, ModelHandle model);
+    Renderable(Graphics& graphics, ModelHandle model,
+               const MaterialOverrides& overrides = {});
+    // Adopts an entity built by Graphics::create_renderables
+    Renderable(Graphics& graphics, utils::Entity entity, ModelHandle model);
+    Renderable(const Renderable&) = delete;
+    Renderable(Renderable&& other) noexcept;
 
+    Renderable& operator=(const Renderable&) = delete;
+    Renderable& operator=(Renderable&& other) noexcept;
+
+    // Moves the renderable to the shared instance matching its new overrides
+    void set_parameter(Graphics& graphics, std::string_view name, Vec4f value,
+                       uint8_t components);
+    // Destroys the Filament entity and releases the instance, leaving the
+    // renderable empty
+    void release();
+
+    Graphics* graphics;
     utils::Entity entity;
+    ModelHandle model;
+    MaterialOverrides overrides;
+    filament::MaterialInstance* instance;
 };
 
 struct Sun {
@@ -50,13 +79,56 @@ struct DirectionalLight {
     utils::Entity entity;
 };
 
+// Colour and depth target of an offscreen view at one resolution bucket
+struct OffscreenTarget {
+    filament::RenderTarget* target;
+    filament::Texture* color;
+    filament::Texture* depth;
+    // Tracked under MemoryTag::GRAPHICS
+    size_t size;
+};
+
+struct OffscreenView {
+    // At a resolution scale of 1
+    uint32_t width, height;
+    uint32_t bucket;
+    // Kept once allocated, so the scale may go back and forth for free
+    std::unordered_map<uint32_t, OffscreenTarget> targets;
+};
+
 struct Graphics {
+    // Resolution scales are rounded up to multiples of 1 / resolution_buckets
+    static constexpr uint32_t resolution_buckets = 8;
+
     Graphics(GLFWwindow* window, ImGuiContext* context);
+    // Headless, renders through the no-op backend into an offscreen swap chain
+    Graphics(uint32_t width, uint32_t height);
     filament::View* create_view();
     std::tuple<filament::View*, filament::Texture*>
     create_offscreen_view(uint32_t width, uint32_t height);
+    // Colour texture the offscreen view currently renders into, it changes
+    // along with the resolution scale
+    filament::Texture* offscreen_texture(const filament::View* view) const;
+    // Offscreen views switch to the target of the scale's bucket, on-screen
+    // views let Filament render at the scale and upscale
+    void set_resolution_scale(float scale);
     void render(std::function<void()> imgui_commands);
     utils::Entity create_entity(ModelHandle model);
+    // Builds count renderables sharing the model's base material instance
+    // with one builder and adds them to the scene at once
+    std::vector<utils::Entity> create_renderables(const Model& model,
+                                                  size_t count);
+    // Orders renderable storage by material instance after it changed.
+    // References into the storage, such as the one Entity:add returns to
+    // Lua, point at another entity's renderable afterwards.
+    void sort_renderables(entt::registry& registry);
+    // Destroys the Filament entity and releases the material instance of
+    // every Renderable the registry destroys from now on
+    void track_renderables(entt::registry& registry);
+    void destroy_renderable(entt::registry& registry, entt::entity entity);
+    // Uploads this frame's bone palettes in one call, growing the shared
+    // skinning buffer when needed
+    void upload_bones(const std::vector<filament::math::mat4f>& bones);
     ~Graphics();
 
     void bind(Scripting& scripting);
@@ -68,8 +140,16 @@ struct Graphics {
     filament::Scene* scene;
     std::vector<filament::View*> views;
     std::vector<filament::View*> offscreen_views;
-    std::vector<filament::RenderTarget*> offscreen_targets;
-    std::vector<filament::Texture*> textures;
+    // Parallel to offscreen_views
+    std::vector<OffscreenView> offscreen_targets;
+    float resolution_scale = 1;
     filament::View* ui_view;
     std::shared_ptr<filagui::ImGuiHelper> imgui_helper;
+    bool renderables_dirty = false;
+    filament::SkinningBuffer* skinning_buffer = nullptr;
+    size_t skinning_capacity = 0;
+    // Bumped whenever skinning_buffer is rebuilt
+    uint64_t skinning_generation = 0;
 };
+
+#endif // GRAPHICS_H_
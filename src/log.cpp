@@ -0,0 +1,113 @@
+#include "log.h"
+#include "scripting.h"
+
+#include <cstdlib>
+#include <string>
+
+Log& Log::get() {
+    static Log log;
+    return log;
+}
+
+Log::Log() {
+    quill::start();
+    for (size_t i = 0; i < channel_count; i++) {
+        loggers[i] = quill::create_logger(name(LogChannel(i)));
+        loggers[i]->set_log_level(quill::LogLevel::Info);
+    }
+}
+
+const char* Log::name(LogChannel channel) {
+    switch (channel) {
+    case LogChannel::ENGINE:
+        return "engine";
+    case LogChannel::GRAPHICS:
+        return "graphics";
+    case LogChannel::ASSETS:
+        return "assets";
+    case LogChannel::AUDIO:
+        return "audio";
+    case LogChannel::NAVIGATION:
+        return "navigation";
+    case LogChannel::WORLD:
+        return "world";
+    case LogChannel::SCRIPTING:
+        return "scripting";
+    case LogChannel::COUNT:
+        break;
+    }
+    return "?";
+}
+
+void Log::exit(int code) {
+    get().flush();
+    std::exit(code);
+}
+
+void Log::set_level(LogChannel channel, quill::LogLevel level) {
+    logger(channel)->set_log_level(level);
+}
+
+void Log::set_level(quill::LogLevel level) {
+    for (auto logger : loggers)
+        logger->set_log_level(level);
+}
+
+void Log::flush() {
+    quill::flush();
+}
+
+bool parse_log_level(std::string_view name, quill::LogLevel& level) {
+    if (name == "trace")
+        level = quill::LogLevel::TraceL1;
+    else if (name == "debug")
+        level = quill::LogLevel::Debug;
+    else if (name == "info")
+        level = quill::LogLevel::Info;
+    else if (name == "warning")
+        level = quill::LogLevel::Warning;
+    else if (name == "error")
+        level = quill::LogLevel::Error;
+    else if (name == "critical")
+        level = quill::LogLevel::Critical;
+    else
+        return false;
+    return true;
+}
+
+void Log::bind(Scripting& scripting) {
+    auto& lua = scripting.lua;
+    auto scripts = logger(LogChannel::SCRIPTING);
+    lua["log"] = lua.create_table();
+    // The message is copied into the queue, never formatted on this thread
+    lua["log"]["debug"] = [scripts](std::string message) { LOG_DEBUG(scripts, "{}", message); };
+    lua["log"]["info"] = [scripts](std::string message) { LOG_INFO(scripts, "{}", message); };
+    lua["log"]["warning"] = [scripts](std::string message) { LOG_WARNING(scripts, "{}", message); };
+    lua["log"]["error"] = [scripts](std::string message) { LOG_ERROR(scripts, "{}", message); };
+    // Same output as Lua's, but queued like everything else
+    lua["print"] = [scripts](sol::variadic_args args, sol::this_state state) {
+        sol::function tostring = sol::state_view(state)["tostring"];
+        std::string message;
+        for (size_t i = 0; i < args.size(); i++) {
+            if (i > 0)
+                message += '\t';
+            message += tostring(args[i]).get<std::string>();
+        }
+        LOG_INFO(scripts, "{}", message);
+    };
+    lua["log"]["set_level"] = [this](std::string_view level_name, sol::optional<std::string_view> channel_name) {
+        quill::LogLevel level;
+        if (!parse_log_level(level_name, level))
+            throw sol::error("Unknown log level '" + std::string(level_name) + "'");
+        if (!channel_name) {
+            set_level(level);
+            return;
+        }
+        for (size_t i = 0; i < channel_count; i++)
+            if (*channel_name == name(LogChannel(i))) {
+                set_level(LogChannel(i), level);
+                return;
+            }
+        throw sol::error("Unknown log channel '" + std::string(*channel_name) + "'");
+    };
+}
@@ -0,0 +1,58 @@
+#ifndef LOG_H_
+#define LOG_H_
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <quill/Quill.h>
+
+struct Scripting;
+
+enum class LogChannel : uint8_t {
+    ENGINE,
+    GRAPHICS,
+    ASSETS,
+    AUDIO,
+    NAVIGATION,
+    WORLD,
+    SCRIPTING,
+    COUNT
+};
+
+// One quill logger per subsystem. Callers only copy their arguments into a
+// thread-local queue, formatting and writing happen on quill's backend
+// thread. Levels below MERCURY_LOG_LEVEL are compiled out, the rest can be
+// raised or lowered per channel at runtime. Messages put their fields last
+// as key=value pairs, e.g. "Loaded asset=fox ms=1.25", so they can be
+// grepped and parsed.
+struct Log {
+    static constexpr size_t channel_count = size_t(LogChannel::COUNT);
+
+    static Log& get();
+    static const char* name(LogChannel channel);
+    // Flushes, then exits; queued messages would be lost otherwise
+    [[noreturn]] static void exit(int code);
+
+    quill::Logger* logger(LogChannel channel) const {
+        return loggers[size_t(channel)];
+    }
+    void set_level(LogChannel channel, quill::LogLevel level);
+    void set_level(quill::LogLevel level);
+    // Blocks until the backend has written everything queued so far
+    void flush();
+    void bind(Scripting& scripting);
+
+    std::array<quill::Logger*, channel_count> loggers;
+
+  private:
+    Log();
+};
+
+inline quill::Logger* logger(LogChannel channel) {
+    return Log::get().logger(channel);
+}
+
+// "trace", "debug", "info", "warning", "error" or "critical"
+bool parse_log_level(std::string_view name, quill::LogLevel& level);
+
+#endif // LOG_H_
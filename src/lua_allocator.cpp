@@ -0,0 +1,98 @@
+#include "lua_allocator.h"
+#include "memory.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static size_t size_class(size_t size) {
+    return (size + LuaAllocator::granularity - 1) / LuaAllocator::granularity -
+           1;
+}
+
+LuaAllocator::~LuaAllocator() {
+    for (auto chunk : chunks)
+        std::free(chunk);
+}
+
+void* LuaAllocator::allocate(void* user_data, void* ptr, size_t old_size,
+                             size_t new_size) {
+    auto& allocator = *static_cast<LuaAllocator*>(user_data);
+    if (!ptr)
+        old_size = 0;
+    if (new_size == 0) {
+        if (ptr)
+            allocator.free(ptr, old_size);
+        return nullptr;
+    }
+    if (ptr && old_size <= max_pooled_size && new_size <= max_pooled_size &&
+        size_class(old_size) == size_class(new_size)) {
+        allocator.heap_size += new_size - old_size;
+        MemoryTracker::get().resize(MemoryTag::LUA, old_size, new_size);
+        return ptr;
+    }
+    if (ptr && old_size > max_pooled_size && new_size > max_pooled_size) {
+        auto resized = std::realloc(ptr, new_size);
+        if (resized) {
+            allocator.heap_size += new_size - old_size;
+            ++allocator.allocations;
+            MemoryTracker::get().free(MemoryTag::LUA, old_size);
+            MemoryTracker::get().allocate(MemoryTag::LUA, new_size);
+        }
+        return resized;
+    }
+    auto block = allocator.alloc(new_size);
+    if (block && ptr) {
+        std::memcpy(block, ptr, std::min(old_size, new_size));
+        allocator.free(ptr, old_size);
+    }
+    return block;
+}
+
+void* LuaAllocator::alloc(size_t size) {
+    void* block;
+    if (size > max_pooled_size) {
+        block = std::malloc(size);
+    } else {
+        auto c = size_class(size);
+        if (!free_lists[c])
+            refill(c);
+        auto head = free_lists[c];
+        if (!head)
+            return nullptr;
+        free_lists[c] = head->next;
+        block = head;
+    }
+    if (block) {
+        heap_size += size;
+        ++allocations;
+        MemoryTracker::get().allocate(MemoryTag::LUA, size);
+    }
+    return block;
+}
+
+void LuaAllocator::free(void* ptr, size_t size) {
+    heap_size -= size;
+    MemoryTracker::get().free(MemoryTag::LUA, size);
+    if (size > max_pooled_size) {
+        std::free(ptr);
+        return;
+    }
+    auto c = size_class(size);
+    auto block = static_cast<FreeBlock*>(ptr);
+    block->next = free_lists[c];
+    free_lists[c] = block;
+}
+
+void LuaAllocator::refill(size_t size_class) {
+    auto chunk = static_cast<char*>(std::malloc(chunk_size));
+    if (!chunk)
+        return;
+    chunks.push_back(chunk);
+    auto block_size = (size_class + 1) * granularity;
+    for (size_t offset = 0; offset + block_size <= chunk_size;
+         offset += block_size) {
+        auto block = reinterpret_cast<FreeBlock*>(chunk + offset);
+        block->next = free_lists[size_class];
+        free_lists[size_class] = block;
+    }
+}
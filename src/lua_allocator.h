@@ -0,0 +1,41 @@
+#ifndef LUA_ALLOCATOR_H_
+#define LUA_ALLOCATOR_H_
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Size-class pool for the small, short-lived objects Lua churns through
+// (strings, tables, closures). Larger blocks go straight to malloc.
+struct LuaAllocator {
+    static constexpr size_t granularity = 16;
+    static constexpr size_t max_pooled_size = 256;
+    static constexpr size_t class_count = max_pooled_size / granularity;
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    LuaAllocator() = default;
+    LuaAllocator(const LuaAllocator&) = delete;
+    ~LuaAllocator();
+
+    LuaAllocator& operator=(const LuaAllocator&) = delete;
+
+    // lua_Alloc compatible entry point, user data is the allocator
+    static void* allocate(void* user_data, void* ptr, size_t old_size,
+                          size_t new_size);
+
+    size_t heap_size = 0;
+    size_t allocations = 0;
+
+  private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    void* alloc(size_t size);
+    void free(void* ptr, size_t size);
+    void refill(size_t size_class);
+
+    std::array<FreeBlock*, class_count> free_lists{};
+    std::vector<void*> chunks;
+};
+
+#endif // LUA_ALLOCATOR_H_
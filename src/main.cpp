@@ -16,7 +16,9 @@
 #include <cereal/cereal.hpp>
 #include <chrono>
 #include <filesystem>
+#include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <thread>
 #include <entt/entt.hpp>
 #undef Success // X11 defines this
@@ -24,8 +26,23 @@
 #include <filament/RenderableManager.h>
 
 #include "animator.h"
+#include "audio.h"
+#include "dynamic_resolution.h"
+#include "entity.h"
+#include "log.h"
+#include "memory.h"
+#include "navigation.h"
+#include "prefab.h"
+#include "recording.h"
+#include "profiler.h"
+#include "script_shards.h"
 #include "scripting.h"
+#include "snapshot.h"
+#include "spatial_index.h"
+#include "startup.h"
 #include "transform.h"
+#include "warmup.h"
+#include "world_partition.h"
 
 void button_callback(GLFWwindow* win, int bt, int action, int mods);
 void cursor_callback(GLFWwindow* win, double x, double y);
@@ -49,7 +66,7 @@ void key_callback(GLFWwindow* win, int key, int scancode, int action,
 }
 
 void error_callback(int err, const char* desc) {
-    printf("GLFW error: %s (%d)\n", desc, err);
+    LOG_ERROR(logger(LogChannel::GRAPHICS), "GLFW error code={} description={}", err, desc);
 }
 
 void resize_callback(GLFWwindow* window, int width, int height) {}
@@ -60,14 +77,72 @@ void char_callback(GLFWwindow* win, unsigned int key) {}
 
 //#ifdef DOCTEST_CONFIG_DISABLE
 int main(int argc, char* argv[]) {
-    glfwSetErrorCallback(error_callback);
+    Recording recording;
+    std::string report_path, startup_trace_path;
+    bool fast = false;
+    size_t script_shards = 0;
+    std::string record_path, replay_path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--fast")
+            fast = true;
+        else if (arg == "--record" && i + 1 < argc)
+            record_path = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (arg == "--report" && i + 1 < argc)
+            report_path = argv[++i];
+        else if (arg == "--script-shards" && i + 1 < argc) {
+            std::string value = argv[++i];
+            try {
+                size_t end = 0;
+                script_shards = std::stoul(value, &end);
+                if (end != value.size())
+                    throw std::invalid_argument(value);
+            } catch (const std::exception&) {
+                LOG_CRITICAL(logger(LogChannel::ENGINE), "Expected a number for --script-shards value={}", value);
+                Log::exit(EXIT_FAILURE);
+            }
+        }
+        else if (arg == "--startup-trace" && i + 1 < argc)
+            startup_trace_path = argv[++i];
+        else if (arg == "--log-level" && i + 1 < argc) {
+            quill::LogLevel level;
+            if (!parse_log_level(argv[++i], level)) {
+                LOG_CRITICAL(logger(LogChannel::ENGINE), "Unknown log level={}", std::string(argv[i]));
+                Log::exit(EXIT_FAILURE);
+            }
+            Log::get().set_level(level);
+        } else {
+            LOG_CRITICAL(logger(LogChannel::ENGINE), "Unknown argument={}", arg);
+            Log::exit(EXIT_FAILURE);
+        }
+    }
+    if (!record_path.empty() && !recording.record(record_path))
+        Log::exit(EXIT_FAILURE);
+    if (!replay_path.empty() && !recording.replay(replay_path, fast))
+        Log::exit(EXIT_FAILURE);
 
-    Scripting scripting;
+    // Started before the window so that they overlap Filament's startup
+    Startup startup;
+    std::vector<Scripting::Script> scripts, shard_scripts;
+    auto compile_scripts = startup.async("compile_scripts", {}, [&] {
+        scripts = Scripting::compile_scripts("assets/scripts");
+    });
+    auto compile_shard_scripts = startup.async("compile_shard_scripts", {}, [&] {
+        if (script_shards > 0)
+            shard_scripts = Scripting::compile_scripts("assets/shards");
+    });
+    auto prefetch = startup.async("prefetch_assets", {}, [] {
+        Warmup::prefetch({"assets/manifest.json", "cache/warmup.json"});
+    });
 
+    auto step = startup.begin("window");
+    glfwSetErrorCallback(error_callback);
 
     if (!glfwInit()) {
-        printf("Error: cannot setup glfw.\n");
-        exit(EXIT_FAILURE);
+        LOG_CRITICAL(logger(LogChannel::GRAPHICS), "Cannot initialize GLFW");
+        Log::exit(EXIT_FAILURE);
     }
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
@@ -80,7 +155,7 @@ int main(int argc, char* argv[]) {
     win = glfwCreateWindow(1600, 900, "Mercury", NULL, NULL);
     if (!win) {
         glfwTerminate();
-        exit(EXIT_FAILURE);
+        Log::exit(EXIT_FAILURE);
     }
 
     glfwSetFramebufferSizeCallback(win, resize_callback);
@@ -90,56 +165,128 @@ int main(int argc, char* argv[]) {
     glfwSetMouseButtonCallback(win, button_callback);
     glfwSetScrollCallback(win, scroll_callback);
 
+    MemoryTracker::track_imgui();
     auto imgui_context = ImGui::CreateContext();
     ImGui_ImplGlfw_InitForVulkan(win, true);
+    // After ImGui, which chains to the callbacks installed before it
+    recording.attach(win);
+    startup.end(step);
 
     {
-        entt::registry registry;
-        struct Entity { entt::registry::entity_type id; };
-
+        step = startup.begin("graphics");
         Graphics graphics(win, imgui_context);
+        startup.end(step);
+        step = startup.begin("systems");
+        // Sounds stop their voices on unload, so the mixer must outlive them
+        Audio audio;
         AssetLibrary assets(*graphics.engine);
+        // Declared after the assets so that every handle is dropped first
+        entt::registry registry;
+        graphics.track_renderables(registry);
+        Scripting scripting;
         Animator animator;
+        SpatialIndex spatial(registry);
+        WorldPartition world(registry, graphics, assets);
+        Navigation navigation(registry);
+        DynamicResolution resolution;
+        startup.end(step);
 
-        scripting.lua.new_usertype<Entity>("Entity",
-            sol::meta_function::construct, [&registry]() { return Entity{ registry.create() }; },
-            "add", sol::overload(
-                // TODO: automate this
-                [&registry](Entity entity, Transform& component) -> Transform& { return registry.emplace<Transform>(entity.id, component); },
-                [&registry](Entity entity, Renderable& component) -> Renderable& { return registry.emplace<Renderable>(entity.id, component); },
-                [&registry](Entity entity, Sun& component) -> Sun& { return registry.emplace<Sun>(entity.id, component); },
-                [&registry](Entity entity, DirectionalLight& component) -> DirectionalLight& { return registry.emplace<DirectionalLight>(entity.id, component); },
-                [&registry](Entity entity, SkeletalAnimation& component) -> SkeletalAnimation& { return registry.emplace<SkeletalAnimation>(entity.id, component); }
-            ));
+        step = startup.begin("bindings");
+        Entity::bind(scripting, registry);
         Transform::bind(scripting);
         assets.bind(scripting);
         graphics.bind(scripting);
         animator.bind(scripting);
-        scripting.load_scripts("assets/scripts");
+        Prefab::bind(scripting, registry, graphics);
+        Snapshot::bind(scripting, registry, graphics, assets);
+        spatial.bind(scripting, graphics);
+        Profiler::get().bind(scripting);
+        world.bind(scripting);
+        navigation.bind(scripting);
+        audio.bind(scripting, registry);
+        resolution.bind(scripting);
+        recording.bind(scripting);
+        MemoryTracker::get().bind(scripting);
+        Log::get().bind(scripting);
+        ScriptShards shards(registry, script_shards);
+        // Only bindings that are safe to call from the shards' workers
+        shards.bind_engine([&](Scripting& shard) {
+            Transform::bind(shard);
+            recording.bind(shard);
+            Log::get().bind(shard);
+        });
+        shards.bind(scripting);
+        startup.end(step);
 
+        startup.wait(prefetch);
+        step = startup.begin("warmup");
+        {
+            Warmup warmup(graphics, assets);
+            warmup.load_manifest("assets/manifest.json");
+            warmup.load_manifest("cache/warmup.json");
+            while (warmup.step() && !glfwWindowShouldClose(win)) {
+                graphics.render([&warmup] {
+                    ImGui_ImplGlfw_NewFrame();
+                    ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
+                    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+                    ImGui::Begin("##Warmup", NULL,
+                                 ImGuiWindowFlags_NoDecoration |
+                                     ImGuiWindowFlags_NoSavedSettings);
+                    ImGui::Text("Preparing %s", warmup.current.c_str());
+                    ImGui::ProgressBar(warmup.progress());
+                    ImGui::End();
+                });
+                glfwPollEvents();
+            }
+        }
+        startup.end(step);
+
+        startup.wait(compile_scripts);
+        startup.wait(compile_shard_scripts);
+        step = startup.begin("run_scripts");
+        scripting.run_scripts(std::move(scripts));
+        shards.run_scripts(shard_scripts);
+        startup.end(step);
+
+        step = startup.begin("scene");
         auto sun = registry.create();
         registry.emplace<Sun>(sun, graphics);
 
         auto dir_light = registry.create();
         registry.emplace<DirectionalLight>(dir_light, graphics);
 
-        auto [ov, tx] = graphics.create_offscreen_view(960, 720);
+        auto ov = std::get<0>(graphics.create_offscreen_view(960, 720));
+        startup.end(step);
 
         TextEditor editor;
         editor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
 
         std::string current_file;
-        auto start_time = std::chrono::high_resolution_clock::now();
+        float elapsed_time = 0;
         auto last_time = std::chrono::high_resolution_clock::now();
-        while (!glfwWindowShouldClose(win)) {
+        auto first_frame = startup.begin("first_frame");
+        bool started = false;
+        while (!glfwWindowShouldClose(win) && !recording.finished()) {
             auto new_time = std::chrono::high_resolution_clock::now();
-            float dt = std::chrono::duration_cast<std::chrono::duration<float>>(new_time - last_time).count();
-            float elapsed_time = std::chrono::duration_cast<std::chrono::duration<float>>(new_time - start_time).count();
+            float dt = recording.begin_frame(std::chrono::duration_cast<std::chrono::duration<float>>(new_time - last_time).count());
+            elapsed_time += dt;
             last_time = new_time;
 
+            shards.update(dt);
+
+            navigation.update(dt);
             animator.update(dt, registry);
             animator.update_renderables(registry, graphics);
+            graphics.sort_renderables(registry);
             Transform::propagate_transforms(registry, graphics);
+            spatial.update();
+            world.update(Vec3f(ov->getCamera().getPosition()));
+            audio.update(registry, dt, Vec3f(ov->getCamera().getPosition()),
+                         Vec3f(ov->getCamera().getForwardVector()),
+                         Vec3f(ov->getCamera().getUpVector()));
+            scripting.step_gc();
+            assets.update();
+            MemoryTracker::get().sample(registry, assets);
 
             for (auto& view : graphics.offscreen_views)
                 view->getCamera().lookAt(
@@ -148,7 +295,7 @@ int main(int argc, char* argv[]) {
                         Vec3f{20, 0, 0},
                     {0, 0, 0}, {0, 1, 0});
 
-            graphics.render([tx = tx, &current_file, &scripting, &editor]() mutable {
+            graphics.render([tx = graphics.offscreen_texture(ov), &current_file, &scripting, &editor]() mutable {
                 ImGui_ImplGlfw_NewFrame();
                 ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
                 ImGui::SetNextWindowSize(ImVec2(ImGui::GetIO().DisplaySize.x,
@@ -179,20 +326,60 @@ int main(int argc, char* argv[]) {
                                 }
                             }
                             ImGui::ListBoxFooter();
+                            ImGui::Text("Lua heap: %zu KiB", scripting.gc_stats.heap_size / 1024);
+                            ImGui::Text("GC step: %.3f ms", scripting.gc_stats.step_time * 1000);
+                            ImGui::Text("Allocations: %zu", scripting.gc_stats.allocations);
                             ImGui::NextColumn();
                             editor.Render("");
                             ImGui::Columns(1);
                             ImGui::EndTabItem();
                         }
+                        if (ImGui::BeginTabItem("Profiler")) {
+                            Profiler::get().draw();
+                            ImGui::EndTabItem();
+                        }
+                        if (ImGui::BeginTabItem("Memory")) {
+                            MemoryTracker::get().draw();
+                            ImGui::EndTabItem();
+                        }
                         ImGui::EndTabBar();
                     }
                 }
                 ImGui::End();
             });
-            std::this_thread::sleep_for(std::chrono::milliseconds(16));
+            // The frame's own work, without the sleep below or a replay's
+            // recorded delta; the scale applies from the next frame
+            graphics.set_resolution_scale(resolution.update(
+                std::chrono::duration_cast<std::chrono::duration<float>>(
+                    std::chrono::high_resolution_clock::now() - new_time).count()));
+            recording.end_frame();
+            if (!started) {
+                startup.end(first_frame);
+                started = true;
+                if (!startup_trace_path.empty() &&
+                    !startup.write_trace(startup_trace_path))
+                    LOG_ERROR(logger(LogChannel::ENGINE), "Failed to write startup trace path={}", startup_trace_path);
+            }
+            // Replays pace themselves from the recorded deltas
+            if (recording.mode != Recording::Mode::REPLAY)
+                std::this_thread::sleep_for(std::chrono::milliseconds(16));
             glfwPollEvents();
+            Profiler::get().end_frame();
+            MemoryTracker::get().end_frame();
+        }
+        if (recording.mode == Recording::Mode::REPLAY) {
+            if (report_path.empty()) {
+                recording.write_report(std::cout);
+            } else {
+                std::ofstream report(report_path);
+                recording.write_report(report);
+            }
         }
+        Warmup::save_manifest(assets, "cache/warmup.json");
+        // Fires the on_destroy hooks while the systems behind them still exist
+        registry.clear();
     }
     glfwTerminate();
+    Log::get().flush();
     return EXIT_SUCCESS;
 }
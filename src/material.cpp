@@ -0,0 +1,100 @@
+#include "material.h"
+#include <algorithm>
+#include <cstring>
+#include <filament/Engine.h>
+#include <filament/Material.h>
+#include <filament/MaterialInstance.h>
+
+void MaterialOverrides::set(std::string_view name, Vec4f value,
+                            uint8_t components) {
+    MaterialParameter parameter{intern_asset(name), components, value};
+    for (uint8_t i = components; i < 4; i++)
+        parameter.value[i] = 0;
+    auto it = std::lower_bound(parameters.begin(), parameters.end(), parameter,
+                               [](auto& a, auto& b) { return a.name.hash < b.name.hash; });
+    if (it != parameters.end() && it->name == parameter.name)
+        *it = parameter;
+    else
+        parameters.insert(it, parameter);
+}
+
+size_t MaterialOverrides::hash() const {
+    uint64_t h = hash_name({});
+    for (auto& parameter : parameters) {
+        h = (h ^ parameter.name.hash) * 1099511628211ull;
+        for (uint8_t i = 0; i < parameter.components; i++) {
+            uint32_t bits;
+            std::memcpy(&bits, &parameter.value[i], sizeof(bits));
+            h = (h ^ bits) * 1099511628211ull;
+        }
+    }
+    return h;
+}
+
+void apply_parameter(filament::MaterialInstance* instance,
+                     const MaterialParameter& parameter) {
+    auto& name = asset_name(parameter.name);
+    auto& v = parameter.value;
+    switch (parameter.components) {
+    case 1:
+        instance->setParameter(name.c_str(), v.x);
+        break;
+    case 2:
+        instance->setParameter(name.c_str(), Vec2f{v.x, v.y});
+        break;
+    case 3:
+        instance->setParameter(name.c_str(), Vec3f{v.x, v.y, v.z});
+        break;
+    case 4:
+        instance->setParameter(name.c_str(), v);
+        break;
+    }
+}
+
+filament::MaterialInstance*
+Material::acquire(const MaterialOverrides& overrides) {
+    if (overrides.parameters.empty())
+        return instance;
+    auto hash = overrides.hash();
+    auto [begin, end] = variants.equal_range(hash);
+    for (auto it = begin; it != end; ++it) {
+        if (it->second.overrides == overrides) {
+            ++it->second.ref_count;
+            return it->second.instance;
+        }
+    }
+    auto variant = shader->createInstance();
+    for (auto& parameter : parameters)
+        apply_parameter(variant, parameter);
+    for (auto& parameter : overrides.parameters)
+        apply_parameter(variant, parameter);
+    variants.emplace(hash, Variant{overrides, variant, 1});
+    variant_hashes.emplace(variant, hash);
+    return variant;
+}
+
+void Material::release(filament::Engine& engine,
+                       filament::MaterialInstance* released) {
+    auto hash = variant_hashes.find(released);
+    if (hash == variant_hashes.end())
+        return;
+    auto [begin, end] = variants.equal_range(hash->second);
+    for (auto it = begin; it != end; ++it) {
+        if (it->second.instance == released) {
+            if (--it->second.ref_count == 0) {
+                engine.destroy(released);
+                variants.erase(it);
+                variant_hashes.erase(hash);
+            }
+            return;
+        }
+    }
+}
+
+void Material::destroy(filament::Engine& engine) {
+    for (auto& [hash, variant] : variants)
+        engine.destroy(variant.instance);
+    variants.clear();
+    variant_hashes.clear();
+    engine.destroy(instance);
+}
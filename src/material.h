@@ -1,10 +1,57 @@
 #ifndef MATERIAL_H_
 #define MATERIAL_H_
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
 #include "asset_library.h"
+#include "primitives.h"
+
+struct MaterialParameter {
+    AssetId name;
+    // Number of floats used from value, 1 to 4
+    uint8_t components;
+    Vec4f value;
+
+    bool operator==(const MaterialParameter& other) const {
+        return name == other.name && components == other.components &&
+               value == other.value;
+    }
+};
+
+// Per-entity parameter values layered over a material, kept sorted by name
+// so that equal overrides compare and hash equal
+struct MaterialOverrides {
+    void set(std::string_view name, Vec4f value, uint8_t components);
+    size_t hash() const;
+
+    bool operator==(const MaterialOverrides& other) const {
+        return parameters == other.parameters;
+    }
+
+    std::vector<MaterialParameter> parameters;
+};
 
 struct Material {
+    // Returns an instance shared by every user with equal overrides
+    filament::MaterialInstance* acquire(const MaterialOverrides& overrides);
+    void release(filament::Engine& engine, filament::MaterialInstance* instance);
+    void destroy(filament::Engine& engine);
+
     filament::MaterialInstance* instance;
     ShaderHandle shader;
+    std::vector<MaterialParameter> parameters;
+
+    struct Variant {
+        MaterialOverrides overrides;
+        filament::MaterialInstance* instance;
+        size_t ref_count;
+    };
+    std::unordered_multimap<size_t, Variant> variants;
+    std::unordered_map<filament::MaterialInstance*, size_t> variant_hashes;
 };
 
+void apply_parameter(filament::MaterialInstance* instance,
+                     const MaterialParameter& parameter);
+
 #endif // MATERIAL_H_
@@ -0,0 +1,185 @@
+#include "memory.h"
+#include "animator.h"
+#include "asset_library.h"
+#include "audio.h"
+#include "graphics.h"
+#include "navigation.h"
+#include "scripting.h"
+#include "transform.h"
+#include "log.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+#include "imgui.h"
+
+MemoryTracker& MemoryTracker::get() {
+    static MemoryTracker tracker;
+    return tracker;
+}
+
+const char* MemoryTracker::name(MemoryTag tag) {
+    static const char* names[tag_count] = {"assets", "meshes", "animation", "ecs",
+                                           "lua", "graphics", "ui"};
+    return names[size_t(tag)];
+}
+
+void MemoryTracker::raise_peak(Counter& counter, int64_t current) {
+    auto peak = counter.peak.load(std::memory_order_relaxed);
+    while (current > peak &&
+           !counter.peak.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+        ;
+}
+
+void MemoryTracker::allocate(MemoryTag tag, size_t size) {
+    auto& counter = counters[size_t(tag)];
+    counter.allocations.fetch_add(1, std::memory_order_relaxed);
+    int64_t bytes = size;
+    raise_peak(counter, counter.current.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void MemoryTracker::free(MemoryTag tag, size_t size) {
+    counters[size_t(tag)].current.fetch_sub(int64_t(size), std::memory_order_relaxed);
+}
+
+void MemoryTracker::resize(MemoryTag tag, size_t old_size, size_t new_size) {
+    auto& counter = counters[size_t(tag)];
+    int64_t delta = int64_t(new_size) - int64_t(old_size);
+    raise_peak(counter, counter.current.fetch_add(delta, std::memory_order_relaxed) + delta);
+}
+
+void MemoryTracker::set(MemoryTag tag, size_t size) {
+    auto& counter = counters[size_t(tag)];
+    counter.current.store(int64_t(size), std::memory_order_relaxed);
+    raise_peak(counter, int64_t(size));
+}
+
+void MemoryTracker::sample(entt::registry& registry, const AssetLibrary& assets) {
+    // Component pools only, EnTT's sparse sets are small next to them
+    size_t ecs = 0;
+    auto pool = [&]<typename Component>(Component*) {
+        ecs += registry.view<Component>().size() * sizeof(Component);
+    };
+    pool((Transform*)nullptr);
+    pool((Renderable*)nullptr);
+    pool((SkeletalAnimation*)nullptr);
+    pool((Sun*)nullptr);
+    pool((DirectionalLight*)nullptr);
+    pool((AudioEmitter*)nullptr);
+    pool((NavAgent*)nullptr);
+    set(MemoryTag::ECS, ecs);
+    // Meshes are tagged on their own
+    set(MemoryTag::ASSETS, assets.animations.resident + assets.skeletons.resident +
+                               assets.materials.resident + assets.sounds.resident);
+}
+
+void MemoryTracker::end_frame() {
+    for (size_t i = 0; i < tag_count; i++) {
+        auto& counter = counters[i];
+        counter.frame_allocations = counter.allocations.exchange(0, std::memory_order_relaxed);
+        auto current = counter.current.load(std::memory_order_relaxed);
+        bool over = current > 0 && size_t(current) > counter.budget;
+        if (over && !counter.over_budget)
+            LOG_WARNING(logger(LogChannel::ENGINE), "Memory budget exceeded tag={} bytes={} budget={}",
+                        name(MemoryTag(i)), current, counter.budget);
+        counter.over_budget = over;
+    }
+}
+
+nlohmann::json MemoryTracker::json() const {
+    nlohmann::json tags;
+    for (size_t i = 0; i < tag_count; i++) {
+        auto& counter = counters[i];
+        auto& tag = tags[name(MemoryTag(i))];
+        tag["current"] = counter.current.load(std::memory_order_relaxed);
+        tag["peak"] = counter.peak.load(std::memory_order_relaxed);
+        tag["allocations_per_frame"] = counter.frame_allocations;
+        if (counter.budget != SIZE_MAX)
+            tag["budget"] = counter.budget;
+        tag["over_budget"] = counter.over_budget;
+    }
+    return tags;
+}
+
+bool MemoryTracker::dump(const std::string& path) const {
+    std::ofstream file(path);
+    file << json().dump(4) << std::endl;
+    return bool(file);
+}
+
+void MemoryTracker::track_imgui() {
+    // ImGui frees without a size, so each block carries it in front
+    constexpr size_t header = alignof(std::max_align_t);
+    ImGui::SetAllocatorFunctions(
+        [](size_t size, void*) -> void* {
+            auto block = static_cast<char*>(std::malloc(size + header));
+            if (!block)
+                return nullptr;
+            *reinterpret_cast<size_t*>(block) = size;
+            get().allocate(MemoryTag::UI, size);
+            return block + header;
+        },
+        [](void* ptr, void*) {
+            if (!ptr)
+                return;
+            auto block = static_cast<char*>(ptr) - header;
+            get().free(MemoryTag::UI, *reinterpret_cast<size_t*>(block));
+            std::free(block);
+        });
+}
+
+void MemoryTracker::draw() {
+    if (ImGui::Button("Dump"))
+        dump("memory.json");
+    ImGui::Columns(5, "##MemoryStats");
+    ImGui::Text("Tag");
+    ImGui::NextColumn();
+    ImGui::Text("Current (KiB)");
+    ImGui::NextColumn();
+    ImGui::Text("Peak (KiB)");
+    ImGui::NextColumn();
+    ImGui::Text("Allocations/frame");
+    ImGui::NextColumn();
+    ImGui::Text("Budget");
+    ImGui::NextColumn();
+    for (size_t i = 0; i < tag_count; i++) {
+        auto& counter = counters[i];
+        auto current = counter.current.load(std::memory_order_relaxed);
+        ImGui::Text("%s", name(MemoryTag(i)));
+        ImGui::NextColumn();
+        ImGui::Text("%.1f", current / 1024.0);
+        ImGui::NextColumn();
+        ImGui::Text("%.1f", counter.peak.load(std::memory_order_relaxed) / 1024.0);
+        ImGui::NextColumn();
+        ImGui::Text("%llu", (unsigned long long)counter.frame_allocations);
+        ImGui::NextColumn();
+        if (counter.budget != SIZE_MAX) {
+            if (counter.over_budget)
+                ImGui::PushStyleColor(ImGuiCol_PlotHistogram, ImVec4(0.9f, 0.2f, 0.2f, 1));
+            ImGui::ProgressBar(std::min(1.0, double(current) / counter.budget));
+            if (counter.over_budget)
+                ImGui::PopStyleColor();
+        }
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
+void MemoryTracker::bind(Scripting& scripting) {
+    auto& lua = scripting.lua;
+    auto tag = [](const std::string& tag_name) {
+        for (size_t i = 0; i < tag_count; i++)
+            if (tag_name == name(MemoryTag(i)))
+                return MemoryTag(i);
+        throw sol::error("Unknown memory tag '" + tag_name + "'");
+    };
+    lua["memory"] = lua.create_table();
+    lua["memory"]["dump"] = [this](const std::string& path) { return dump(path); };
+    lua["memory"]["set_budget"] = [this, tag](const std::string& tag_name, size_t bytes) {
+        counters[size_t(tag(tag_name))].budget = bytes;
+    };
+    lua["memory"]["current"] = [this, tag](const std::string& tag_name) {
+        return counters[size_t(tag(tag_name))].current.load(std::memory_order_relaxed);
+    };
+}
@@ -0,0 +1,99 @@
+#ifndef MEMORY_H_
+#define MEMORY_H_
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <entt/entity/fwd.hpp>
+#include <nlohmann/json_fwd.hpp>
+
+struct AssetLibrary;
+struct Scripting;
+
+enum class MemoryTag : uint8_t {
+    ASSETS,
+    MESHES,
+    ANIMATION,
+    ECS,
+    LUA,
+    GRAPHICS,
+    UI,
+    COUNT
+};
+
+// Bytes in use per subsystem. Tags are fed either by allocation hooks, which
+// may run on any thread, or sampled once a frame for memory we only observe.
+struct MemoryTracker {
+    static constexpr size_t tag_count = size_t(MemoryTag::COUNT);
+
+    struct Counter {
+        std::atomic<int64_t> current = 0;
+        std::atomic<int64_t> peak = 0;
+        std::atomic<uint64_t> allocations = 0;
+        // Allocations during the last whole frame
+        uint64_t frame_allocations = 0;
+        size_t budget = SIZE_MAX;
+        bool over_budget = false;
+    };
+
+    static MemoryTracker& get();
+    static const char* name(MemoryTag tag);
+    // Routes ImGui's allocations to the UI tag, call before creating a context
+    static void track_imgui();
+
+    void allocate(MemoryTag tag, size_t size);
+    void free(MemoryTag tag, size_t size);
+    // A block grown or shrunk in place, not counted as an allocation
+    void resize(MemoryTag tag, size_t old_size, size_t new_size);
+    // Replaces the tag's current size with one measured from outside
+    void set(MemoryTag tag, size_t size);
+    // Measures the tags with no allocation hooks
+    void sample(entt::registry& registry, const AssetLibrary& assets);
+    // Latches per-frame allocation counts and warns once per budget overrun
+    void end_frame();
+
+    nlohmann::json json() const;
+    bool dump(const std::string& path) const;
+    void draw();
+    void bind(Scripting& scripting);
+
+    std::array<Counter, tag_count> counters;
+
+  private:
+    MemoryTracker() = default;
+    void raise_peak(Counter& counter, int64_t current);
+};
+
+// Counts a container's heap usage against a tag
+template <typename T, MemoryTag Tag> struct TaggedAllocator {
+    using value_type = T;
+
+    template <typename U> struct rebind {
+        using other = TaggedAllocator<U, Tag>;
+    };
+
+    TaggedAllocator() = default;
+    template <typename U> TaggedAllocator(const TaggedAllocator<U, Tag>&) {}
+
+    T* allocate(size_t count) {
+        MemoryTracker::get().allocate(Tag, count * sizeof(T));
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T* ptr, size_t count) {
+        MemoryTracker::get().free(Tag, count * sizeof(T));
+        std::allocator<T>().deallocate(ptr, count);
+    }
+
+    template <typename U> bool operator==(const TaggedAllocator<U, Tag>&) const {
+        return true;
+    }
+};
+
+template <typename T, MemoryTag Tag>
+using TaggedVector = std::vector<T, TaggedAllocator<T, Tag>>;
+
+#endif // MEMORY_H_
@@ -1,13 +1,143 @@
 #include "mesh.h"
 #include "math/norm.h"
 #include "primitives.h"
-#include <iostream>
+#include "worker_pool.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-Mesh::Mesh(filament::Engine& engine, const std::string& path) {
+// Same as packSnorm16 on every quaternion, two per SSE2 instruction.
+// _mm_cvtps_epi32 rounds half to even where packSnorm16 rounds half away
+// from zero, so this truncates and then rounds the remainder itself.
+static void pack_snorm16(const filament::math::quatf* frames,
+                         filament::math::short4* packed, size_t count) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const auto min = _mm_set1_ps(-1), max = _mm_set1_ps(1), scale = _mm_set1_ps(32767);
+    const auto half = _mm_set1_ps(0.5f), minus_half = _mm_set1_ps(-0.5f);
+    auto to_snorm = [&](__m128 v) {
+        v = _mm_mul_ps(_mm_min_ps(_mm_max_ps(v, min), max), scale);
+        auto whole = _mm_cvttps_epi32(v);
+        // Exact, both have the same sign and differ by less than 1
+        auto fraction = _mm_sub_ps(v, _mm_cvtepi32_ps(whole));
+        // All ones where true, so subtracting adds 1 and adding subtracts 1
+        whole = _mm_sub_epi32(whole, _mm_castps_si128(_mm_cmpge_ps(fraction, half)));
+        return _mm_add_epi32(whole, _mm_castps_si128(_mm_cmple_ps(fraction, minus_half)));
+    };
+    for (; i + 2 <= count; i += 2) {
+        auto a = to_snorm(_mm_loadu_ps(&frames[i].x));
+        auto b = to_snorm(_mm_loadu_ps(&frames[i + 1].x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&packed[i]), _mm_packs_epi32(a, b));
+    }
+#endif
+    for (; i < count; i++)
+        packed[i] = filament::math::packSnorm16(frames[i].xyzw);
+}
+
+// Rescales weights that do not sum to 1, leaving unskinned vertices alone
+static void normalize_weights(Vec4f* weights, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+#if defined(__SSE2__)
+        auto w = _mm_loadu_ps(&weights[i].x);
+        auto sums = _mm_add_ps(w, _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 3, 0, 1)));
+        sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+        float sum = _mm_cvtss_f32(sums);
+        if (sum > 0 && (sum < 0.99f || sum > 1.01f))
+            _mm_storeu_ps(&weights[i].x, _mm_div_ps(w, _mm_set1_ps(sum)));
+#else
+        auto& w = weights[i];
+        float sum = w.x + w.y + w.z + w.w;
+        if (sum > 0 && (sum < 0.99f || sum > 1.01f))
+            w = w / sum;
+#endif
+    }
+}
+
+// Everything but the Filament buffers, which must be created on the engine's
+// thread, is split in two. gather_part sizes the part's buffers and scatters
+// its bone weights, then process_vertices fills in a range of vertices.
+void Mesh::gather_part(Part& part, const aiMesh* mesh) const {
+    part.indices.resize(size_t(mesh->mNumFaces) * 3);
+    for (size_t j = 0; j < mesh->mNumFaces; j++)
+        std::copy_n(mesh->mFaces[j].mIndices, 3, &part.indices[j * 3]);
+    part.positions.resize(mesh->mNumVertices);
+    part.tangents.resize(mesh->mNumVertices);
+
+    if (mesh->mNumBones > 0) {
+        part.bone_indices.assign(mesh->mNumVertices, {0, 0, 0, 0});
+        part.bone_weights.assign(mesh->mNumVertices, {0, 0, 0, 0});
+        for (size_t j = 0; j < mesh->mNumBones; j++) {
+            auto bone = mesh->mBones[j];
+            uint16_t bone_index = bone_name_to_index.at(bone->mName.C_Str());
+            for (size_t k = 0; k < bone->mNumWeights; k++) {
+                auto vertex_index = bone->mWeights[k].mVertexId;
+                auto& bi = part.bone_indices[vertex_index];
+                auto& bw = part.bone_weights[vertex_index];
+                float weight = bone->mWeights[k].mWeight;
+                // Keeps the four largest, in no particular order
+                size_t lightest = 0;
+                for (size_t slot = 1; slot < 4; slot++)
+                    if (bw[slot] < bw[lightest])
+                        lightest = slot;
+                if (weight > bw[lightest]) {
+                    bw[lightest] = weight;
+                    bi[lightest] = bone_index;
+                }
+            }
+        }
+    }
+}
+
+// Returns the bounding radius of the range
+float Mesh::process_vertices(Part& part, const aiMesh* mesh, size_t first,
+                             size_t last) const {
+    auto vertices = reinterpret_cast<const Vec3f*>(mesh->mVertices);
+    std::copy(vertices + first, vertices + last, &part.positions[first]);
+    float range_radius = 0;
+    for (size_t j = first; j < last; j++)
+        range_radius = std::max(range_radius, dot(part.positions[j], part.positions[j]));
+    range_radius = std::sqrt(range_radius);
+
+    auto tangents = reinterpret_cast<const Vec3f*>(mesh->mTangents);
+    auto bitangents = reinterpret_cast<const Vec3f*>(mesh->mBitangents);
+    auto normals = reinterpret_cast<const Vec3f*>(mesh->mNormals);
+    // Frames go through a small stack buffer, packed a block at a time
+    constexpr size_t block = 256;
+    filament::math::quatf frames[block];
+    for (size_t begin = first; begin < last; begin += block) {
+        auto count = std::min<size_t>(block, last - begin);
+        for (size_t j = 0; j < count; j++) {
+            Vec3f normal = normals[begin + j];
+            Vec3f tangent;
+            Vec3f bitangent;
+            if (!tangents) {
+                bitangent = normalize(cross(normal, Vec3f{1.0, 0.0, 0.0}));
+                tangent = normalize(cross(normal, bitangent));
+            } else {
+                tangent = tangents[begin + j];
+                bitangent = bitangents[begin + j];
+            }
+            frames[j] = filament::math::details::TMat33<float>::packTangentFrame(
+                {tangent, bitangent, normal});
+        }
+        pack_snorm16(frames, &part.tangents[begin], count);
+    }
+
+    if (mesh->mNumBones > 0)
+        normalize_weights(&part.bone_weights[first], last - first);
+    return range_radius;
+}
+
+Mesh::Mesh(filament::Engine& engine, std::span<const char> data,
+           const char* format) {
     Assimp::Importer importer;
-    auto scene = importer.ReadFile(
-        path, aiProcess_LimitBoneWeights | aiProcess_Triangulate |
-                  aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+    auto scene = importer.ReadFileFromMemory(
+        data.data(), data.size(),
+        aiProcess_LimitBoneWeights | aiProcess_Triangulate |
+            aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace,
+        format);
 
     for (size_t i = 0; i < scene->mNumMeshes; i++) {
         auto mesh = scene->mMeshes[i];
@@ -26,6 +156,42 @@ Mesh::Mesh(filament::Engine& engine, const std::string& path) {
     }
 
     parts.resize(scene->mNumMeshes);
+    // Parts and then ranges of their vertices go to the shared workers, so a
+    // single dense part spreads over them too. Filament buffers are created
+    // after they are done. Small meshes, e.g. streamed props, are not worth it.
+    const size_t min_parallel_vertices = 16384;
+    const size_t chunk_vertices = 4096;
+    struct Chunk {
+        size_t part;
+        size_t first, last;
+        float radius;
+    };
+    std::vector<Chunk> chunks;
+    size_t vertex_count = 0;
+    for (size_t i = 0; i < parts.size(); i++) {
+        size_t part_vertices = scene->mMeshes[i]->mNumVertices;
+        for (size_t first = 0; first < part_vertices; first += chunk_vertices)
+            chunks.push_back({i, first, std::min(first + chunk_vertices, part_vertices), 0});
+        vertex_count += part_vertices;
+    }
+    auto gather = [&](size_t i) { gather_part(parts[i], scene->mMeshes[i]); };
+    auto process = [&](size_t i) {
+        auto& chunk = chunks[i];
+        chunk.radius = process_vertices(parts[chunk.part], scene->mMeshes[chunk.part],
+                                        chunk.first, chunk.last);
+    };
+    if (vertex_count < min_parallel_vertices) {
+        for (size_t i = 0; i < parts.size(); i++)
+            gather(i);
+        for (size_t i = 0; i < chunks.size(); i++)
+            process(i);
+    } else {
+        WorkerPool::get().run(parts.size(), gather);
+        WorkerPool::get().run(chunks.size(), process);
+    }
+    for (auto& chunk : chunks)
+        radius = std::max(radius, chunk.radius);
+
     for (size_t i = 0; i < scene->mNumMeshes; i++) {
         auto mesh = scene->mMeshes[i];
         parts[i].index_buffer =
@@ -33,78 +199,11 @@ Mesh::Mesh(filament::Engine& engine, const std::string& path) {
                 .indexCount(mesh->mNumFaces * 3)
                 .bufferType(filament::IndexBuffer::IndexType::UINT)
                 .build(engine);
-
-        for (size_t j = 0; j < mesh->mNumFaces; j++) {
-            auto& face = mesh->mFaces[j];
-            parts[i].indices.push_back(face.mIndices[0]);
-            parts[i].indices.push_back(face.mIndices[1]);
-            parts[i].indices.push_back(face.mIndices[2]);
-        }
         parts[i].index_buffer->setBuffer(
             engine, filament::backend::BufferDescriptor(
                         parts[i].indices.data(),
                         sizeof(uint32_t) * parts[i].indices.size()));
 
-        for (size_t j = 0; j < mesh->mNumVertices; j++) {
-            auto& vertex = mesh->mVertices[j];
-            parts[i].positions.push_back({vertex.x, vertex.y, vertex.z});
-        }
-        Vec3f* tangents = reinterpret_cast<Vec3f*>(mesh->mTangents);
-        Vec3f* bitangents = reinterpret_cast<Vec3f*>(mesh->mBitangents);
-        Vec3f* normals = reinterpret_cast<Vec3f*>(mesh->mNormals);
-        for (size_t j = 0; j < mesh->mNumVertices; j++) {
-            Vec3f normal = normals[j];
-            Vec3f tangent;
-            Vec3f bitangent;
-            if (!tangents) {
-                bitangent = normalize(cross(normal, Vec3f{1.0, 0.0, 0.0}));
-                tangent = normalize(cross(normal, bitangent));
-            } else {
-                tangent = tangents[j];
-                bitangent = bitangents[j];
-            }
-            filament::math::quatf q =
-                filament::math::details::TMat33<float>::packTangentFrame(
-                    {tangent, bitangent, normal});
-            parts[i].tangents.push_back(filament::math::packSnorm16(q.xyzw));
-        }
-        if (mesh->mNumBones > 0) {
-            parts[i].bone_indices.resize(mesh->mNumVertices, {0, 0, 0, 0});
-            parts[i].bone_weights.resize(mesh->mNumVertices, {0, 0, 0, 0});
-            for (size_t j = 0; j < mesh->mNumBones; j++) {
-                auto bone = mesh->mBones[j];
-                for (size_t k = 0; k < bone->mNumWeights; k++) {
-                    auto vertex_index = bone->mWeights[k].mVertexId;
-                    auto bone_index =
-                        bone_name_to_index.at(bone->mName.C_Str());
-                    auto& bi = parts[i].bone_indices[vertex_index];
-                    auto& bw = parts[i].bone_weights[vertex_index];
-                    float weight = bone->mWeights[k].mWeight;
-                    if (weight > bw.w) {
-                        bw.w = weight;
-                        bi.w = bone_index;
-                    }
-                    if (bw.w > bw.z) {
-                        std::swap(bw.w, bw.z);
-                        std::swap(bi.w, bi.z);
-                    }
-                    if (bw.z > bw.y) {
-                        std::swap(bw.z, bw.y);
-                        std::swap(bi.z, bi.y);
-                    }
-                    if (bw.y > bw.x) {
-                        std::swap(bw.y, bw.x);
-                        std::swap(bi.y, bi.x);
-                    }
-                }
-            }
-            for (auto& bw : parts[i].bone_weights) {
-                float sum = bw.x + bw.y + bw.z + bw.w;
-                if (sum < 0.99 || sum > 1.01)
-                    bw = bw * 1 / sum;
-            }
-        }
-
         filament::VertexBuffer::Builder vb_builder;
         vb_builder.vertexCount(mesh->mNumVertices)
             .bufferCount(mesh->mNumBones > 0 ? 4 : 2)
@@ -148,5 +247,11 @@ Mesh::Mesh(filament::Engine& engine, const std::string& path) {
                     parts[i].bone_weights.data(),
                     sizeof(Vec4f) * parts[i].bone_weights.size()));
         }
+        gpu_size += parts[i].indices.size() * sizeof(uint32_t) +
+                    parts[i].positions.size() * sizeof(Vec3f) +
+                    parts[i].tangents.size() * sizeof(filament::math::short4) +
+                    parts[i].bone_indices.size() * sizeof(filament::math::ushort4) +
+                    parts[i].bone_weights.size() * sizeof(Vec4f);
     }
+    MemoryTracker::get().allocate(MemoryTag::GRAPHICS, gpu_size);
 }
@@ -1,5 +1,6 @@
 #ifndef MODEL_LOADER_H_
 #define MODEL_LOADER_H_
+#include <span>
 #include <vector>
 
 #include "asset_library.h"
@@ -14,10 +15,13 @@
 #include <assimp/scene.h>
 #include <unordered_map>
 
+#include "memory.h"
 #include "primitives.h"
 
 struct Mesh {
-    Mesh(filament::Engine& engine, const std::string& path);
+    // format is the file extension Assimp should parse data as, e.g. "glb"
+    Mesh(filament::Engine& engine, std::span<const char> data,
+         const char* format);
 
     std::vector<ozz::math::Float4x4> inverse_binds;
     std::unordered_map<std::string, uint16_t> bone_name_to_index;
@@ -25,13 +29,20 @@ struct Mesh {
     struct Part {
         filament::IndexBuffer* index_buffer;
         filament::VertexBuffer* vertex_buffer;
-        std::vector<uint32_t> indices;
-        std::vector<Vec3f> positions;
-        std::vector<filament::math::short4> tangents;
-        std::vector<filament::math::ushort4> bone_indices;
-        std::vector<Vec4f> bone_weights;
+        TaggedVector<uint32_t, MemoryTag::MESHES> indices;
+        TaggedVector<Vec3f, MemoryTag::MESHES> positions;
+        TaggedVector<filament::math::short4, MemoryTag::MESHES> tangents;
+        TaggedVector<filament::math::ushort4, MemoryTag::MESHES> bone_indices;
+        TaggedVector<Vec4f, MemoryTag::MESHES> bone_weights;
     };
     std::vector<Part> parts;
+    void gather_part(Part& part, const aiMesh* mesh) const;
+    float process_vertices(Part& part, const aiMesh* mesh, size_t first,
+                           size_t last) const;
+    // Bytes uploaded to the vertex and index buffers
+    size_t gpu_size = 0;
+    // Of the bounding sphere around the origin
+    float radius = 0;
 };
 
 #endif // MODEL_LOADER_H_
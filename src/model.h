@@ -1,13 +1,19 @@
 #ifndef MODEL_H_
 #define MODEL_H_
 #include "asset_library.h"
+#include "pose_pool.h"
 #include <filament/MaterialInstance.h>
+#include <memory>
 
 struct Model {
     MeshHandle mesh;
     MaterialHandle material;
     SkeletonHandle skeleton;
     std::vector<AnimationHandle> animations;
+    // Mesh bone index of each skeleton joint, -1 if it skins nothing
+    std::vector<int16_t> joint_bones;
+    // Poses of the model's SkeletalAnimations
+    std::unique_ptr<PosePool> poses;
 };
 
 #endif
@@ -0,0 +1,496 @@
+#include "navigation.h"
+#include "asset_library.h"
+#include "entity.h"
+#include "mesh.h"
+#include "model.h"
+#include "profiler.h"
+#include "scripting.h"
+#include "transform.h"
+#include "log.h"
+
+#include <DetourAlloc.h>
+#include <DetourCrowd.h>
+#include <DetourNavMesh.h>
+#include <DetourNavMeshBuilder.h>
+#include <DetourNavMeshQuery.h>
+#include <Recast.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+static constexpr int max_path_polys = 256;
+static constexpr int max_path_points = 256;
+static constexpr float query_extents[3] = {2, 4, 2};
+
+static int64_t tile_key(int32_t x, int32_t z) {
+    return int64_t(uint64_t(uint32_t(x)) << 32 | uint32_t(z));
+}
+
+template <typename T> static std::string_view bytes(const T* data, size_t count) {
+    return {reinterpret_cast<const char*>(data), count * sizeof(T)};
+}
+
+Navigation::Navigation(entt::registry& _registry, Settings _settings)
+    : registry(_registry), settings(_settings),
+      bake_pool(std::max(1u, std::thread::hardware_concurrency()) - 1) {
+    dtNavMeshParams params{};
+    params.tileWidth = tile_width();
+    params.tileHeight = tile_width();
+    params.maxTiles = 4096;
+    params.maxPolys = 1024;
+    navmesh = dtAllocNavMesh();
+    if (dtStatusFailed(navmesh->init(&params))) {
+        LOG_CRITICAL(logger(LogChannel::NAVIGATION), "Failed to create navmesh");
+        Log::exit(1);
+    }
+    queries.resize(WorkerPool::get().concurrency());
+    for (auto& query : queries) {
+        query = dtAllocNavMeshQuery();
+        query->init(navmesh, 2048);
+    }
+    crowd = dtAllocCrowd();
+    crowd->init(max_agents, settings.agent_radius, navmesh);
+    registry.on_destroy<NavAgent>().connect<&Navigation::on_destroy>(*this);
+}
+
+Navigation::~Navigation() {
+    for (auto& worker : workers)
+        worker.wait();
+    registry.on_destroy<NavAgent>().disconnect<&Navigation::on_destroy>(*this);
+    dtFreeCrowd(crowd);
+    for (auto query : queries)
+        dtFreeNavMeshQuery(query);
+    dtFreeNavMesh(navmesh);
+}
+
+float Navigation::tile_width() const {
+    return settings.tile_size * settings.cell_size;
+}
+
+void Navigation::on_destroy(entt::registry& registry, entt::entity entity) {
+    crowd->removeAgent(registry.get<NavAgent>(entity).index);
+}
+
+uint32_t Navigation::add_geometry(const Mesh& mesh, const Mat4f& transform) {
+    auto added = std::make_shared<Geometry>();
+    added->min = Vec3f(INFINITY);
+    added->max = Vec3f(-INFINITY);
+    for (auto& part : mesh.parts)
+        for (auto index : part.indices) {
+            auto vertex = (transform * Vec4f(part.positions[index], 1)).xyz;
+            added->vertices.push_back(vertex);
+            added->min = min(added->min, vertex);
+            added->max = max(added->max, vertex);
+        }
+    if (added->vertices.empty())
+        return 0;
+    mark_dirty(*added);
+    geometry.emplace(next_geometry, std::move(added));
+    return next_geometry++;
+}
+
+void Navigation::remove_geometry(uint32_t id) {
+    auto it = geometry.find(id);
+    if (it == geometry.end())
+        return;
+    mark_dirty(*it->second);
+    geometry.erase(it);
+}
+
+void Navigation::mark_dirty(const Geometry& changed) {
+    // Tiles rasterize a border around themselves, so their neighbors change too
+    float border =
+        (std::ceil(settings.agent_radius / settings.cell_size) + 3) *
+        settings.cell_size;
+    int32_t min_x = std::floor((changed.min.x - border) / tile_width());
+    int32_t min_z = std::floor((changed.min.z - border) / tile_width());
+    int32_t max_x = std::floor((changed.max.x + border) / tile_width());
+    int32_t max_z = std::floor((changed.max.z + border) / tile_width());
+    for (int32_t x = min_x; x <= max_x; x++)
+        for (int32_t z = min_z; z <= max_z; z++) {
+            auto& tile = tiles[tile_key(x, z)];
+            tile.x = x;
+            tile.z = z;
+            tile.generation++;
+            tile.dirty = true;
+        }
+}
+
+void Navigation::bake() {
+    struct Job {
+        int32_t x, z;
+        uint32_t generation;
+    };
+    auto jobs = std::make_shared<std::vector<Job>>();
+    for (auto& [key, tile] : tiles)
+        if (tile.dirty) {
+            jobs->push_back({tile.x, tile.z, tile.generation});
+            tile.dirty = false;
+        }
+    if (jobs->empty())
+        return;
+
+    // Workers see the geometry as of now, later changes bake again anyway
+    std::vector<uint32_t> ids;
+    for (auto& [id, added] : geometry)
+        ids.push_back(id);
+    std::sort(ids.begin(), ids.end());
+    auto snapshot = std::make_shared<std::vector<std::shared_ptr<const Geometry>>>();
+    for (auto id : ids)
+        snapshot->push_back(geometry[id]);
+
+    std::erase_if(workers, [](auto& worker) {
+        return worker.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    });
+    workers.push_back(std::async(std::launch::async, [this, jobs, snapshot]() {
+        bake_pool.run(jobs->size(), [&](size_t i) {
+            auto& job = (*jobs)[i];
+            auto data = bake_tile(job.x, job.z, *snapshot);
+            std::lock_guard lock(baked_mutex);
+            baked.push_back({job.x, job.z, job.generation, std::move(data)});
+        });
+    }));
+}
+
+bool Navigation::baking() const {
+    return std::any_of(workers.begin(), workers.end(), [](auto& worker) {
+        return worker.wait_for(std::chrono::seconds(0)) !=
+               std::future_status::ready;
+    });
+}
+
+std::vector<uint8_t> Navigation::bake_tile(
+    int32_t x, int32_t z,
+    const std::vector<std::shared_ptr<const Geometry>>& snapshot) const {
+    PROFILE_ZONE("Navigation::bake_tile");
+    rcConfig config{};
+    config.cs = settings.cell_size;
+    config.ch = settings.cell_height;
+    config.walkableSlopeAngle = settings.agent_max_slope;
+    config.walkableHeight = std::ceil(settings.agent_height / config.ch);
+    config.walkableClimb = std::floor(settings.agent_climb / config.ch);
+    config.walkableRadius = std::ceil(settings.agent_radius / config.cs);
+    config.maxEdgeLen = 12 / config.cs;
+    config.maxSimplificationError = 1.3f;
+    config.minRegionArea = 8 * 8;
+    config.mergeRegionArea = 20 * 20;
+    config.maxVertsPerPoly = DT_VERTS_PER_POLYGON;
+    config.tileSize = settings.tile_size;
+    config.borderSize = config.walkableRadius + 3;
+    config.width = config.tileSize + config.borderSize * 2;
+    config.height = config.tileSize + config.borderSize * 2;
+    config.detailSampleDist = 6 * config.cs;
+    config.detailSampleMaxError = config.ch;
+
+    float border = config.borderSize * config.cs;
+    config.bmin[0] = x * tile_width() - border;
+    config.bmin[2] = z * tile_width() - border;
+    config.bmax[0] = (x + 1) * tile_width() + border;
+    config.bmax[2] = (z + 1) * tile_width() + border;
+    config.bmin[1] = INFINITY;
+    config.bmax[1] = -INFINITY;
+
+    std::vector<Vec3f> vertices;
+    for (auto& added : snapshot) {
+        if (added->max.x < config.bmin[0] || added->min.x > config.bmax[0] ||
+            added->max.z < config.bmin[2] || added->min.z > config.bmax[2])
+            continue;
+        auto& soup = added->vertices;
+        for (size_t i = 0; i < soup.size(); i += 3) {
+            auto lo = min(soup[i], min(soup[i + 1], soup[i + 2]));
+            auto hi = max(soup[i], max(soup[i + 1], soup[i + 2]));
+            if (hi.x < config.bmin[0] || lo.x > config.bmax[0] ||
+                hi.z < config.bmin[2] || lo.z > config.bmax[2])
+                continue;
+            vertices.insert(vertices.end(), &soup[i], &soup[i] + 3);
+            config.bmin[1] = std::min(config.bmin[1], lo.y);
+            config.bmax[1] = std::max(config.bmax[1], hi.y);
+        }
+    }
+    if (vertices.empty())
+        return {};
+
+    auto hash = hash_name(bytes(&settings, 1)) ^
+                hash_name(bytes(vertices.data(), vertices.size())) * 1099511628211ull ^
+                uint64_t(tile_key(x, z)) * 14695981039346656037ull;
+    std::ostringstream name;
+    name << "assets/cache/navmesh/" << std::hex << hash << ".tile";
+    std::filesystem::path path = name.str();
+    if (std::ifstream file{path, std::ios::binary}) {
+        std::vector<uint8_t> data(std::filesystem::file_size(path));
+        file.read(reinterpret_cast<char*>(data.data()), data.size());
+        return data;
+    }
+
+    std::vector<int> triangles(vertices.size());
+    for (size_t i = 0; i < triangles.size(); i++)
+        triangles[i] = i;
+    std::vector<uint8_t> areas(vertices.size() / 3, 0);
+    auto positions = &vertices[0].x;
+    int vertex_count = vertices.size();
+    int triangle_count = areas.size();
+
+    rcContext context(false);
+    std::unique_ptr<rcHeightfield, decltype(&rcFreeHeightField)> solid(
+        rcAllocHeightfield(), rcFreeHeightField);
+    std::unique_ptr<rcCompactHeightfield, decltype(&rcFreeCompactHeightfield)> compact(
+        rcAllocCompactHeightfield(), rcFreeCompactHeightfield);
+    std::unique_ptr<rcContourSet, decltype(&rcFreeContourSet)> contours(
+        rcAllocContourSet(), rcFreeContourSet);
+    std::unique_ptr<rcPolyMesh, decltype(&rcFreePolyMesh)> polys(
+        rcAllocPolyMesh(), rcFreePolyMesh);
+    std::unique_ptr<rcPolyMeshDetail, decltype(&rcFreePolyMeshDetail)> detail(
+        rcAllocPolyMeshDetail(), rcFreePolyMeshDetail);
+
+    bool built =
+        rcCreateHeightfield(&context, *solid, config.width, config.height,
+                            config.bmin, config.bmax, config.cs, config.ch);
+    if (built) {
+        rcMarkWalkableTriangles(&context, config.walkableSlopeAngle, positions,
+                                vertex_count, triangles.data(), triangle_count,
+                                areas.data());
+        built = rcRasterizeTriangles(&context, positions, vertex_count,
+                                     triangles.data(), areas.data(),
+                                     triangle_count, *solid, config.walkableClimb);
+    }
+    if (built) {
+        rcFilterLowHangingWalkableObstacles(&context, config.walkableClimb, *solid);
+        rcFilterLedgeSpans(&context, config.walkableHeight, config.walkableClimb, *solid);
+        rcFilterWalkableLowHeightSpans(&context, config.walkableHeight, *solid);
+        built = rcBuildCompactHeightfield(&context, config.walkableHeight,
+                                          config.walkableClimb, *solid, *compact) &&
+                rcErodeWalkableArea(&context, config.walkableRadius, *compact) &&
+                rcBuildDistanceField(&context, *compact) &&
+                rcBuildRegions(&context, *compact, config.borderSize,
+                               config.minRegionArea, config.mergeRegionArea) &&
+                rcBuildContours(&context, *compact, config.maxSimplificationError,
+                                config.maxEdgeLen, *contours) &&
+                rcBuildPolyMesh(&context, *contours, config.maxVertsPerPoly, *polys) &&
+                rcBuildPolyMeshDetail(&context, *polys, *compact,
+                                      config.detailSampleDist,
+                                      config.detailSampleMaxError, *detail);
+    }
+    if (!built) {
+        LOG_ERROR(logger(LogChannel::NAVIGATION), "Failed to bake navmesh tile x={} z={}", x, z);
+        return {};
+    }
+
+    std::vector<uint8_t> data;
+    if (polys->npolys > 0) {
+        for (int i = 0; i < polys->npolys; i++)
+            polys->flags[i] = polys->areas[i] == RC_WALKABLE_AREA ? 1 : 0;
+        dtNavMeshCreateParams params{};
+        params.verts = polys->verts;
+        params.vertCount = polys->nverts;
+        params.polys = polys->polys;
+        params.polyAreas = polys->areas;
+        params.polyFlags = polys->flags;
+        params.polyCount = polys->npolys;
+        params.nvp = polys->nvp;
+        params.detailMeshes = detail->meshes;
+        params.detailVerts = detail->verts;
+        params.detailVertsCount = detail->nverts;
+        params.detailTris = detail->tris;
+        params.detailTriCount = detail->ntris;
+        params.walkableHeight = settings.agent_height;
+        params.walkableRadius = settings.agent_radius;
+        params.walkableClimb = settings.agent_climb;
+        params.tileX = x;
+        params.tileY = z;
+        rcVcopy(params.bmin, polys->bmin);
+        rcVcopy(params.bmax, polys->bmax);
+        params.cs = config.cs;
+        params.ch = config.ch;
+        params.buildBvTree = true;
+        unsigned char* tile;
+        int size;
+        if (!dtCreateNavMeshData(&params, &tile, &size)) {
+            LOG_ERROR(logger(LogChannel::NAVIGATION), "Failed to create navmesh tile x={} z={}", x, z);
+            return {};
+        }
+        data.assign(tile, tile + size);
+        dtFree(tile);
+    }
+
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), data.size());
+    return data;
+}
+
+uint32_t Navigation::find_path(Vec3f start, Vec3f end) {
+    requests.push_back({next_path, start, end});
+    return next_path++;
+}
+
+const Navigation::Path* Navigation::path(uint32_t id) const {
+    auto it = paths.find(id);
+    return it == paths.end() ? nullptr : &it->second;
+}
+
+static std::vector<Vec3f> find(dtNavMeshQuery& query, Vec3f start, Vec3f end) {
+    dtQueryFilter filter;
+    dtPolyRef start_poly, end_poly;
+    float start_point[3], end_point[3];
+    query.findNearestPoly(&start.x, query_extents, &filter, &start_poly, start_point);
+    query.findNearestPoly(&end.x, query_extents, &filter, &end_poly, end_point);
+    if (!start_poly || !end_poly)
+        return {};
+
+    dtPolyRef corridor[max_path_polys];
+    int poly_count = 0;
+    query.findPath(start_poly, end_poly, start_point, end_point, &filter,
+                   corridor, &poly_count, max_path_polys);
+    if (poly_count == 0)
+        return {};
+    // A partial path ends as close to the target as it gets
+    if (corridor[poly_count - 1] != end_poly)
+        query.closestPointOnPoly(corridor[poly_count - 1], end_point, end_point,
+                                 nullptr);
+
+    Vec3f points[max_path_points];
+    int point_count = 0;
+    query.findStraightPath(start_point, end_point, corridor, poly_count,
+                           &points[0].x, nullptr, nullptr, &point_count,
+                           max_path_points);
+    return {points, points + point_count};
+}
+
+void Navigation::serve_paths() {
+    if (requests.empty())
+        return;
+    PROFILE_ZONE("Navigation::serve_paths");
+    std::vector<Request> batch(requests.begin(), requests.end());
+    requests.clear();
+    std::vector<Path> results(batch.size());
+    std::atomic<size_t> next = 0;
+    auto deadline = std::chrono::high_resolution_clock::now() +
+                    std::chrono::duration<float>(path_budget);
+
+    // Navmesh tiles only change between batches, so the queries may share it.
+    // Task t owns queries[t], the pool runs each task on a single thread.
+    WorkerPool::get().run(std::min(queries.size(), batch.size()), [&](size_t t) {
+        // At least one path per task, so requests cannot starve
+        bool served = false;
+        size_t i = 0;
+        while ((!served || std::chrono::high_resolution_clock::now() < deadline) &&
+               (i = next++) < batch.size()) {
+            results[i].points = find(*queries[t], batch[i].start, batch[i].end);
+            served = true;
+        }
+    });
+
+    // Every index handed out was served, the rest wait for the next frame
+    size_t served = std::min(next.load(), batch.size());
+    for (size_t i = 0; i < served; i++)
+        paths[batch[i].id] = std::move(results[i]);
+    requests.insert(requests.end(), batch.begin() + served, batch.end());
+}
+
+bool Navigation::add_agent(entt::entity entity, Vec3f position) {
+    // Replacing would skip on_destroy and leave the old agent in the crowd
+    registry.remove<NavAgent>(entity);
+    dtCrowdAgentParams params{};
+    params.radius = settings.agent_radius;
+    params.height = settings.agent_height;
+    params.maxAcceleration = 8;
+    params.maxSpeed = 3.5f;
+    params.collisionQueryRange = params.radius * 12;
+    params.pathOptimizationRange = params.radius * 30;
+    params.separationWeight = 2;
+    params.obstacleAvoidanceType = 3;
+    params.updateFlags = DT_CROWD_ANTICIPATE_TURNS | DT_CROWD_OPTIMIZE_VIS |
+                         DT_CROWD_OPTIMIZE_TOPO | DT_CROWD_OBSTACLE_AVOIDANCE |
+                         DT_CROWD_SEPARATION;
+    int index = crowd->addAgent(&position.x, &params);
+    if (index < 0)
+        return false;
+    registry.emplace<NavAgent>(entity, index);
+    return true;
+}
+
+bool Navigation::set_target(entt::entity entity, Vec3f target) {
+    dtPolyRef poly;
+    float point[3];
+    crowd->getNavMeshQuery()->findNearestPoly(
+        &target.x, crowd->getQueryExtents(), crowd->getFilter(0), &poly, point);
+    if (!poly)
+        return false;
+    return crowd->requestMoveTarget(registry.get<NavAgent>(entity).index, poly,
+                                    point);
+}
+
+void Navigation::update(float dt) {
+    PROFILE_ZONE("Navigation::update");
+    workers.erase(std::remove_if(workers.begin(), workers.end(), [](auto& worker) {
+        return worker.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), workers.end());
+
+    std::vector<Baked> finished;
+    {
+        std::lock_guard lock(baked_mutex);
+        finished.swap(baked);
+    }
+    for (auto& result : finished) {
+        auto tile = tiles.find(tile_key(result.x, result.z));
+        if (tile == tiles.end() || tile->second.generation != result.generation)
+            continue;
+        if (auto ref = navmesh->getTileRefAt(result.x, result.z, 0))
+            navmesh->removeTile(ref, nullptr, nullptr);
+        if (result.data.empty())
+            continue;
+        auto data = static_cast<unsigned char*>(dtAlloc(result.data.size(), DT_ALLOC_PERM));
+        std::memcpy(data, result.data.data(), result.data.size());
+        if (dtStatusFailed(navmesh->addTile(data, result.data.size(),
+                                            DT_TILE_FREE_DATA, 0, nullptr)))
+            dtFree(data);
+    }
+
+    serve_paths();
+
+    crowd->update(dt, nullptr);
+    for (auto [entity, agent, transform] : registry.view<NavAgent, Transform>().each()) {
+        auto position = crowd->getAgent(agent.index)->npos;
+        transform.position = {position[0], position[1], position[2]};
+    }
+}
+
+void Navigation::bind(Scripting& scripting) {
+    auto& lua = scripting.lua;
+    lua["navigation"] = lua.create_table();
+    lua["navigation"]["add_geometry"] = [this](const ModelHandle& model, const Transform& transform) {
+        return add_geometry(*model->mesh, transform.matrix());
+    };
+    lua["navigation"]["remove_geometry"] = [this](uint32_t id) { remove_geometry(id); };
+    lua["navigation"]["bake"] = [this]() { bake(); };
+    lua["navigation"]["baking"] = [this]() { return baking(); };
+    lua["navigation"]["find_path"] = [this](Vec3f start, Vec3f end) { return find_path(start, end); };
+    // Nil while pending; a finished path is handed out once
+    lua["navigation"]["path"] = [this](uint32_t id, sol::this_state state) -> sol::object {
+        auto found = path(id);
+        if (!found)
+            return sol::nil;
+        auto table = sol::state_view(state).create_table(found->points.size(), 0);
+        for (size_t i = 0; i < found->points.size(); i++)
+            table[i + 1] = found->points[i];
+        paths.erase(id);
+        return table;
+    };
+    lua["navigation"]["add_agent"] = [this](Entity entity, Vec3f position) {
+        if (!add_agent(entity.id, position))
+            throw sol::error("Navigation crowd is full");
+    };
+    lua["navigation"]["set_target"] = [this](Entity entity, Vec3f target) {
+        if (!registry.try_get<NavAgent>(entity.id))
+            throw sol::error("Entity is not a navigation agent");
+        return set_target(entity.id, target);
+    };
+    lua["navigation"]["set_budget"] = [this](float seconds) { path_budget = seconds; };
+}
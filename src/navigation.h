@@ -0,0 +1,131 @@
+#ifndef NAVIGATION_H_
+#define NAVIGATION_H_
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <entt/entt.hpp>
+
+#include "primitives.h"
+#include "worker_pool.h"
+
+class dtCrowd;
+class dtNavMesh;
+class dtNavMeshQuery;
+
+struct Mesh;
+struct Scripting;
+
+// Index of the entity's agent in the navigation crowd
+struct NavAgent {
+    int index;
+};
+
+// Tiled Recast/Detour navmesh over static level geometry. Changing the
+// geometry marks the tiles it overlaps dirty and bake rebuilds just those on
+// a pool of its own, reusing tiles cached on disk under their geometry hash.
+// Path requests are served in batches on the shared worker pool within a
+// time budget each frame; agents are steered by a Detour crowd.
+struct Navigation {
+    struct Settings {
+        float cell_size = 0.3f;
+        float cell_height = 0.2f;
+        float agent_height = 2.0f;
+        float agent_radius = 0.6f;
+        float agent_climb = 0.9f;
+        float agent_max_slope = 45.0f;
+        // In cells
+        int tile_size = 48;
+    };
+
+    // Triangle soup in world space
+    struct Geometry {
+        std::vector<Vec3f> vertices;
+        Vec3f min, max;
+    };
+
+    struct Tile {
+        int32_t x, z;
+        // Bumped on every change, so stale bakes are dropped
+        uint32_t generation = 0;
+        bool dirty = false;
+    };
+
+    struct Baked {
+        int32_t x, z;
+        uint32_t generation;
+        // Empty if nothing walkable is left in the tile
+        std::vector<uint8_t> data;
+    };
+
+    struct Path {
+        std::vector<Vec3f> points;
+    };
+
+    struct Request {
+        uint32_t id;
+        Vec3f start, end;
+    };
+
+    Navigation(entt::registry& registry, Settings settings = {});
+    ~Navigation();
+
+    uint32_t add_geometry(const Mesh& mesh, const Mat4f& transform);
+    void remove_geometry(uint32_t id);
+    // Starts rebuilding the dirty tiles in the background
+    void bake();
+    bool baking() const;
+
+    uint32_t find_path(Vec3f start, Vec3f end);
+    // Null while the request is pending, the points are empty if unreachable
+    const Path* path(uint32_t id) const;
+
+    // False if the crowd is full
+    bool add_agent(entt::entity entity, Vec3f position);
+    // False if the target is off the navmesh
+    bool set_target(entt::entity entity, Vec3f target);
+
+    // Swaps in baked tiles, serves path requests and moves the agents
+    void update(float dt);
+
+    void bind(Scripting& scripting);
+
+    void on_destroy(entt::registry& registry, entt::entity entity);
+    void mark_dirty(const Geometry& geometry);
+    float tile_width() const;
+    std::vector<uint8_t> bake_tile(int32_t x, int32_t z,
+                                   const std::vector<std::shared_ptr<const Geometry>>& geometry) const;
+    void serve_paths();
+
+    entt::registry& registry;
+    Settings settings;
+    // Seconds per frame spent serving path requests
+    float path_budget = 0.002f;
+    size_t max_agents = 512;
+
+    dtNavMesh* navmesh = nullptr;
+    dtCrowd* crowd = nullptr;
+    // One per task of the shared pool, a query object is not thread safe
+    std::vector<dtNavMeshQuery*> queries;
+
+    uint32_t next_geometry = 1;
+    std::unordered_map<uint32_t, std::shared_ptr<const Geometry>> geometry;
+    std::unordered_map<int64_t, Tile> tiles;
+
+    // A bake takes many frames, so it runs on its own pool rather than
+    // holding the shared one; each bake drives the pool from the background
+    WorkerPool bake_pool;
+    std::vector<std::future<void>> workers;
+    std::mutex baked_mutex;
+    std::vector<Baked> baked;
+
+    uint32_t next_path = 1;
+    std::deque<Request> requests;
+    std::unordered_map<uint32_t, Path> paths;
+};
+
+#endif // NAVIGATION_H_
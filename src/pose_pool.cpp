@@ -0,0 +1,65 @@
+#include "pose_pool.h"
+
+#include <algorithm>
+#include <functional>
+
+PosePool::PosePool(size_t _soa_joints, size_t _joints, size_t _bones)
+    : soa_joints(_soa_joints), joints(_joints), bones(_bones) {
+    static_assert(sizeof(ozz::math::Float4x4) == 64);
+    static_assert(alignof(ozz::math::SoaTransform) <= alignof(ozz::math::Float4x4));
+    locals_size = (soa_joints * sizeof(ozz::math::SoaTransform) +
+                   sizeof(ozz::math::Float4x4) - 1) /
+                  sizeof(ozz::math::Float4x4);
+    stride = locals_size + joints + bones;
+}
+
+uint32_t PosePool::acquire() {
+    if (!free_slots.empty()) {
+        std::pop_heap(free_slots.begin(), free_slots.end(), std::greater<>());
+        auto slot = free_slots.back();
+        free_slots.pop_back();
+        // Its keys are those of the previous instance's time
+        cache(slot).Invalidate();
+        return slot;
+    }
+    reserve(1);
+    return used++;
+}
+
+void PosePool::release(uint32_t slot) {
+    free_slots.push_back(slot);
+    std::push_heap(free_slots.begin(), free_slots.end(), std::greater<>());
+}
+
+void PosePool::reserve(size_t count) {
+    size_t live = used - free_slots.size();
+    while (chunks.size() * chunk_slots < live + count) {
+        chunks.emplace_back(chunk_slots * stride);
+        auto& chunk_caches = caches.emplace_back(
+            std::make_unique<ozz::animation::SamplingCache[]>(chunk_slots));
+        for (uint32_t i = 0; i < chunk_slots; i++)
+            chunk_caches[i].Resize(joints);
+    }
+    // Releasing then never grows the heap either
+    free_slots.reserve(chunks.size() * chunk_slots);
+}
+
+ozz::math::Float4x4* PosePool::slot_data(uint32_t slot) {
+    return chunks[slot / chunk_slots].data() + slot % chunk_slots * stride;
+}
+
+ozz::span<ozz::math::SoaTransform> PosePool::locals(uint32_t slot) {
+    return {reinterpret_cast<ozz::math::SoaTransform*>(slot_data(slot)), soa_joints};
+}
+
+ozz::span<ozz::math::Float4x4> PosePool::models(uint32_t slot) {
+    return {slot_data(slot) + locals_size, joints};
+}
+
+ozz::span<ozz::math::Float4x4> PosePool::skinning_matrices(uint32_t slot) {
+    return {slot_data(slot) + locals_size + joints, bones};
+}
+
+ozz::animation::SamplingCache& PosePool::cache(uint32_t slot) {
+    return caches[slot / chunk_slots][slot % chunk_slots];
+}
@@ -0,0 +1,53 @@
+#ifndef POSE_POOL_H_
+#define POSE_POOL_H_
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "ozz/animation/runtime/sampling_job.h"
+#include "ozz/base/maths/simd_math.h"
+#include "ozz/base/maths/soa_transform.h"
+#include "ozz/base/span.h"
+
+#include "memory.h"
+
+// Pose buffers of every animated instance of one model. A slot holds the
+// local transforms, model matrices and skinning palette back to back, with a
+// stride rounded up to whole 64 byte matrices. Slots live in fixed chunks
+// that are never freed or moved, and the lowest free slot is reused first,
+// so live poses stay packed at the front. Only growing by a chunk allocates.
+struct PosePool {
+    static constexpr uint32_t chunk_slots = 64;
+    static constexpr uint32_t none = UINT32_MAX;
+
+    PosePool(size_t soa_joints, size_t joints, size_t bones);
+
+    uint32_t acquire();
+    void release(uint32_t slot);
+    // Makes room for count more slots, so acquiring them does not allocate
+    void reserve(size_t count);
+
+    ozz::span<ozz::math::SoaTransform> locals(uint32_t slot);
+    ozz::span<ozz::math::Float4x4> models(uint32_t slot);
+    ozz::span<ozz::math::Float4x4> skinning_matrices(uint32_t slot);
+    ozz::animation::SamplingCache& cache(uint32_t slot);
+
+    size_t soa_joints;
+    size_t joints;
+    size_t bones;
+    // In matrices
+    size_t locals_size;
+    size_t stride;
+
+    std::vector<TaggedVector<ozz::math::Float4x4, MemoryTag::ANIMATION>> chunks;
+    // Min-heap
+    TaggedVector<uint32_t, MemoryTag::ANIMATION> free_slots;
+    uint32_t used = 0;
+    // One per slot, parallel to chunks. Instances sample at different
+    // ratios, a shared cache would be rewound and rescanned every time.
+    std::vector<std::unique_ptr<ozz::animation::SamplingCache[]>> caches;
+
+  private:
+    ozz::math::Float4x4* slot_data(uint32_t slot);
+};
+
+#endif // POSE_POOL_H_
@@ -0,0 +1,74 @@
+#include "prefab.h"
+#include <cstdint>
+#include <iterator>
+#include <string>
+
+#include "animator.h"
+#include "entity.h"
+#include "graphics.h"
+#include "model.h"
+#include "profiler.h"
+#include "scripting.h"
+
+std::vector<entt::entity> spawn_many(entt::registry& registry,
+                                     Graphics& graphics, const Prefab& prefab,
+                                     size_t count,
+                                     std::span<const Transform> transforms) {
+    PROFILE_ZONE("spawn_many");
+    std::vector<entt::entity> entities(count);
+    registry.create(entities.begin(), entities.end());
+
+    registry.insert<Transform>(entities.begin(), entities.end(),
+                               prefab.transform);
+    for (size_t i = 0; i < std::min(count, transforms.size()); i++) {
+        auto& transform = registry.get<Transform>(entities[i]);
+        transform.position = transforms[i].position;
+        transform.rotation = transforms[i].rotation;
+        transform.scale *= transforms[i].scale;
+    }
+
+    // Components are move-only, build them first and move them in as a batch
+    auto& renderable_storage = registry.storage<Renderable>();
+    renderable_storage.reserve(renderable_storage.size() + count);
+    std::vector<Renderable> renderables;
+    renderables.reserve(count);
+    for (auto entity : graphics.create_renderables(*prefab.model, count))
+        renderables.emplace_back(graphics, entity, prefab.model);
+    registry.insert<Renderable>(entities.begin(), entities.end(),
+                                std::make_move_iterator(renderables.begin()));
+
+    if (prefab.animation) {
+        // One allocation for the whole batch, at most
+        prefab.model->poses->reserve(count);
+        auto& animation_storage = registry.storage<SkeletalAnimation>();
+        animation_storage.reserve(animation_storage.size() + count);
+        std::vector<SkeletalAnimation> animations;
+        animations.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            animations.emplace_back(prefab.model, prefab.animation);
+        registry.insert<SkeletalAnimation>(entities.begin(), entities.end(),
+                                           std::make_move_iterator(animations.begin()));
+    }
+    return entities;
+}
+
+void Prefab::bind(Scripting& scripting, entt::registry& registry,
+                  Graphics& graphics) {
+    auto& lua = scripting.lua;
+    lua["spawn_many"] = [&registry, &graphics](PrefabHandle prefab, int64_t count,
+                                               sol::optional<sol::table> transforms,
+                                               sol::this_state state) {
+        // Signed so that a negative count is rejected, not wrapped around
+        if (count <= 0)
+            throw sol::error("spawn_many count must be positive, got " + std::to_string(count));
+        std::vector<Transform> placed;
+        if (transforms)
+            for (size_t i = 1; i <= transforms->size(); i++)
+                placed.push_back((*transforms)[i]);
+        auto entities = spawn_many(registry, graphics, *prefab, count, placed);
+        auto result = sol::state_view(state).create_table(entities.size(), 0);
+        for (size_t i = 0; i < entities.size(); i++)
+            result[i + 1] = Entity{entities[i]};
+        return result;
+    };
+}
@@ -0,0 +1,33 @@
+#ifndef PREFAB_H_
+#define PREFAB_H_
+#include <span>
+#include <vector>
+#include <entt/entt.hpp>
+
+#include "asset_library.h"
+#include "transform.h"
+
+struct Graphics;
+struct Scripting;
+
+// Entity template loaded from assets/prefabs, e.g.
+//   {"model": "fox", "animation": "fox_run", "scale": [0.05, 0.05, 0.05]}
+struct Prefab {
+    ModelHandle model;
+    // Empty for static prefabs
+    AnimationHandle animation;
+    Transform transform;
+
+    static void bind(Scripting& scripting, entt::registry& registry,
+                     Graphics& graphics);
+};
+
+// Creates count entities from a prefab, components are inserted a whole
+// batch at a time. transforms[i] places entity i, its scale multiplies the
+// prefab's; entities past the end of transforms keep the prefab transform.
+std::vector<entt::entity> spawn_many(entt::registry& registry,
+                                     Graphics& graphics, const Prefab& prefab,
+                                     size_t count,
+                                     std::span<const Transform> transforms = {});
+
+#endif // PREFAB_H_
@@ -0,0 +1,214 @@
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <nlohmann/json.hpp>
+
+#include "imgui.h"
+#include "scripting.h"
+
+static const auto profiler_epoch = std::chrono::steady_clock::now();
+
+Profiler& Profiler::get() {
+    static Profiler profiler;
+    return profiler;
+}
+
+uint64_t Profiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - profiler_epoch)
+        .count();
+}
+
+void Profiler::ThreadBuffer::push(const Zone& zone) {
+    auto h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == capacity) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    zones[h % capacity] = zone;
+    head.store(h + 1, std::memory_order_release);
+}
+
+Profiler::ThreadBuffer& Profiler::thread_buffer() {
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard lock(buffers_mutex);
+        buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = buffers.back().get();
+        buffer->thread = buffers.size();
+    }
+    return *buffer;
+}
+
+ProfileZone::~ProfileZone() {
+    auto& buffer = Profiler::get().thread_buffer();
+    buffer.push({name, begin, Profiler::now(), buffer.thread});
+}
+
+void Profiler::end_frame() {
+    auto end = now();
+    auto& frame = frames[frame_count % history_size];
+    frame.begin = frame_begin;
+    frame.end = end;
+    frame.zones.clear();
+    {
+        std::lock_guard lock(buffers_mutex);
+        for (auto& buffer : buffers) {
+            auto h = buffer->head.load(std::memory_order_acquire);
+            auto t = buffer->tail.load(std::memory_order_relaxed);
+            for (; t != h; ++t)
+                frame.zones.push_back(buffer->zones[t % ThreadBuffer::capacity]);
+            buffer->tail.store(t, std::memory_order_release);
+        }
+    }
+    std::sort(frame.zones.begin(), frame.zones.end(),
+              [](auto& a, auto& b) { return a.begin < b.begin; });
+    update_stats(frame);
+    ++frame_count;
+    frame_begin = end;
+}
+
+void Profiler::update_stats(const Frame& frame) {
+    std::unordered_map<std::string, float> totals;
+    totals["Frame"] = (frame.end - frame.begin) * 1e-6f;
+    for (auto& zone : frame.zones)
+        totals[zone.name] += (zone.end - zone.begin) * 1e-6f;
+    for (auto& [name, s] : stats)
+        if (!totals.count(name))
+            totals[name] = 0;
+    auto slot = frame_count % history_size;
+    auto count = std::min(frame_count + 1, history_size);
+    for (auto& [name, total] : totals) {
+        auto& s = stats[name];
+        s.last = total;
+        s.history[slot] = total;
+        s.average = 0;
+        s.max = 0;
+        for (size_t i = 0; i < count; i++) {
+            s.average += s.history[i];
+            s.max = std::max(s.max, s.history[i]);
+        }
+        s.average /= count;
+    }
+}
+
+bool Profiler::capture(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file)
+        return false;
+    nlohmann::json events = nlohmann::json::array();
+    auto count = std::min(frame_count, history_size);
+    for (size_t i = frame_count - count; i < frame_count; i++) {
+        auto& frame = frames[i % history_size];
+        events.push_back({{"name", "Frame"},
+                          {"ph", "X"},
+                          {"pid", 1},
+                          {"tid", 0},
+                          {"ts", frame.begin * 1e-3},
+                          {"dur", (frame.end - frame.begin) * 1e-3}});
+        for (auto& zone : frame.zones)
+            events.push_back({{"name", zone.name},
+                              {"ph", "X"},
+                              {"pid", 1},
+                              {"tid", zone.thread},
+                              {"ts", zone.begin * 1e-3},
+                              {"dur", (zone.end - zone.begin) * 1e-3}});
+    }
+    file << nlohmann::json{{"traceEvents", events},
+                           {"displayTimeUnit", "ms"}};
+    return bool(file);
+}
+
+void Profiler::draw() {
+    ImGui::Checkbox("Pause", &paused);
+    ImGui::SameLine();
+    if (ImGui::Button("Capture"))
+        capture("profile.json");
+    if (frame_count == 0)
+        return;
+
+    static Frame shown;
+    if (!paused)
+        shown = frames[(frame_count - 1) % history_size];
+
+    auto& frame_stats = stats["Frame"];
+    std::array<float, history_size> frame_times;
+    for (size_t i = 0; i < history_size; i++)
+        frame_times[i] = frame_stats.history[(frame_count + i) % history_size];
+    ImGui::PlotLines("##FrameTimes", frame_times.data(), frame_times.size(), 0,
+                     "Frame time (ms)", 0, frame_stats.max * 1.2f,
+                     ImVec2(ImGui::GetContentRegionAvail().x, 60));
+
+    // Zones of the last frame, one lane per thread, nested zones stacked
+    auto draw_list = ImGui::GetWindowDrawList();
+    auto origin = ImGui::GetCursorScreenPos();
+    auto width = ImGui::GetContentRegionAvail().x;
+    const float row_height = 18;
+    auto duration = float(std::max<uint64_t>(shown.end - shown.begin, 1));
+    std::unordered_map<uint32_t, std::vector<uint64_t>> stacks;
+    std::vector<size_t> depths;
+    std::map<uint32_t, size_t> thread_depths;
+    for (auto& zone : shown.zones) {
+        auto& stack = stacks[zone.thread];
+        while (!stack.empty() && stack.back() <= zone.begin)
+            stack.pop_back();
+        depths.push_back(stack.size());
+        stack.push_back(zone.end);
+        auto& max_depth = thread_depths[zone.thread];
+        max_depth = std::max(max_depth, stack.size());
+    }
+    // Each thread gets as many rows as its deepest nesting
+    std::unordered_map<uint32_t, size_t> first_rows;
+    size_t rows = 0;
+    for (auto [thread, max_depth] : thread_depths) {
+        first_rows[thread] = rows;
+        rows += max_depth;
+    }
+    for (size_t i = 0; i < shown.zones.size(); i++) {
+        auto& zone = shown.zones[i];
+        auto depth = depths[i];
+        auto x0 = origin.x + (zone.begin - std::min(zone.begin, shown.begin)) / duration * width;
+        auto x1 = origin.x + std::min((zone.end - std::min(zone.end, shown.begin)) / duration, 1.0f) * width;
+        auto y0 = origin.y + (first_rows[zone.thread] + depth) * row_height;
+        auto color = ImGui::GetColorU32(ImVec4(0.3f + 0.1f * (depth % 4), 0.5f, 0.8f, 1));
+        draw_list->AddRectFilled(ImVec2(x0, y0), ImVec2(std::max(x1, x0 + 1), y0 + row_height - 2), color);
+        draw_list->PushClipRect(ImVec2(x0, y0), ImVec2(x1, y0 + row_height), true);
+        draw_list->AddText(ImVec2(x0 + 2, y0 + 1), IM_COL32_WHITE, zone.name);
+        draw_list->PopClipRect();
+    }
+    auto lanes_height = rows * row_height;
+    ImGui::Dummy(ImVec2(width, lanes_height));
+
+    std::vector<std::pair<const std::string*, const Stats*>> sorted;
+    for (auto& [name, s] : stats)
+        sorted.push_back({&name, &s});
+    std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second->average > b.second->average; });
+    ImGui::Columns(4, "##ProfilerStats");
+    ImGui::Text("Zone");
+    ImGui::NextColumn();
+    ImGui::Text("Last (ms)");
+    ImGui::NextColumn();
+    ImGui::Text("Average (ms)");
+    ImGui::NextColumn();
+    ImGui::Text("Max (ms)");
+    ImGui::NextColumn();
+    for (auto [name, s] : sorted) {
+        ImGui::Text("%s", name->c_str());
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", s->last);
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", s->average);
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", s->max);
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
+void Profiler::bind(Scripting& scripting) {
+    auto& lua = scripting.lua;
+    lua["profiler"] = lua.create_table();
+    lua["profiler"]["capture"] = [this](const std::string& path) { return capture(path); };
+}
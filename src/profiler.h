@@ -0,0 +1,90 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef MERCURY_PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
+
+struct Scripting;
+
+struct Profiler {
+    struct Zone {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+        uint32_t thread;
+    };
+
+    // Lock-free ring written only by its owning thread and drained by
+    // end_frame, zones are dropped when it is full
+    struct ThreadBuffer {
+        static constexpr size_t capacity = 4096;
+
+        void push(const Zone& zone);
+
+        std::array<Zone, capacity> zones;
+        std::atomic<size_t> head = 0;
+        std::atomic<size_t> tail = 0;
+        std::atomic<size_t> dropped = 0;
+        uint32_t thread;
+    };
+
+    struct Frame {
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        std::vector<Zone> zones;
+    };
+
+    static constexpr size_t history_size = 120;
+
+    struct Stats {
+        float last = 0;
+        float average = 0;
+        float max = 0;
+        std::array<float, history_size> history{};
+    };
+
+    static Profiler& get();
+    // Nanoseconds since the profiler was created
+    static uint64_t now();
+
+    ThreadBuffer& thread_buffer();
+    void end_frame();
+    bool capture(const std::string& path) const;
+    void draw();
+    void bind(Scripting& scripting);
+
+    std::mutex buffers_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::array<Frame, history_size> frames;
+    size_t frame_count = 0;
+    uint64_t frame_begin = 0;
+    std::unordered_map<std::string, Stats> stats;
+    bool paused = false;
+
+  private:
+    Profiler() = default;
+    void update_stats(const Frame& frame);
+};
+
+struct ProfileZone {
+    ProfileZone(const char* _name) : name(_name), begin(Profiler::now()) {}
+    ~ProfileZone();
+
+    const char* name;
+    uint64_t begin;
+};
+
+#endif // PROFILER_H_
@@ -0,0 +1,213 @@
+#include "recording.h"
+#include "scripting.h"
+#include "log.h"
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/vector.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <ctime>
+#include <ostream>
+#include <random>
+#include <thread>
+
+namespace cereal {
+    template <typename Archive>
+    void serialize(Archive& archive, Recording::Event& event) {
+        using Type = Recording::Event::Type;
+        archive(event.type);
+        // Only the fields the event type uses
+        switch (event.type) {
+        case Type::KEY:
+            archive(event.code, event.scancode, event.action, event.mods);
+            break;
+        case Type::CHAR:
+            archive(event.code);
+            break;
+        case Type::BUTTON:
+            archive(event.code, event.action, event.mods);
+            break;
+        case Type::CURSOR:
+        case Type::SCROLL:
+            archive(event.x, event.y);
+            break;
+        }
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive, Recording::Frame& frame) {
+        archive(frame.dt, frame.events);
+    }
+}
+
+// GLFW callbacks carry no user data we could use, ImGui may own the pointer
+static Recording* attached = nullptr;
+
+Recording::~Recording() {
+    if (attached == this)
+        attached = nullptr;
+}
+
+bool Recording::record(const std::string& path) {
+    file.open(path, std::ios::binary);
+    if (!file) {
+        LOG_ERROR(logger(LogChannel::ENGINE), "Failed to open recording path={}", path);
+        return false;
+    }
+    mode = Mode::RECORD;
+    seed = std::random_device()();
+    start_time = std::time(nullptr);
+    output = std::make_unique<cereal::BinaryOutputArchive>(file);
+    (*output)(magic, current_version, seed, start_time);
+    return true;
+}
+
+bool Recording::replay(const std::string& path, bool _fast) {
+    std::ifstream input_file(path, std::ios::binary);
+    if (!input_file) {
+        LOG_ERROR(logger(LogChannel::ENGINE), "Failed to open recording path={}", path);
+        return false;
+    }
+    try {
+        cereal::BinaryInputArchive input(input_file);
+        uint32_t file_magic, version;
+        input(file_magic, version);
+        if (file_magic != magic || version != current_version) {
+            LOG_ERROR(logger(LogChannel::ENGINE), "Unsupported recording version={}", version);
+            return false;
+        }
+        input(seed, start_time);
+        // A session cut short still replays up to its last whole frame
+        while (input_file.peek() != std::ifstream::traits_type::eof()) {
+            Frame frame;
+            input(frame);
+            frames.push_back(std::move(frame));
+        }
+    } catch (cereal::Exception& e) {
+        if (frames.empty()) {
+            LOG_ERROR(logger(LogChannel::ENGINE), "Malformed recording error={}", e.what());
+            return false;
+        }
+    }
+    mode = Mode::REPLAY;
+    fast = _fast;
+    frame_ms.reserve(frames.size());
+    return true;
+}
+
+void Recording::attach(GLFWwindow* _window) {
+    window = _window;
+    attached = this;
+    key_callback = glfwSetKeyCallback(window, [](GLFWwindow*, int key, int scancode, int action, int mods) {
+        attached->on_event({Event::Type::KEY, key, scancode, action, mods});
+    });
+    char_callback = glfwSetCharCallback(window, [](GLFWwindow*, unsigned int codepoint) {
+        attached->on_event({Event::Type::CHAR, int32_t(codepoint)});
+    });
+    button_callback = glfwSetMouseButtonCallback(window, [](GLFWwindow*, int button, int action, int mods) {
+        attached->on_event({Event::Type::BUTTON, button, 0, action, mods});
+    });
+    cursor_callback = glfwSetCursorPosCallback(window, [](GLFWwindow*, double x, double y) {
+        attached->on_event({Event::Type::CURSOR, 0, 0, 0, 0, x, y});
+    });
+    scroll_callback = glfwSetScrollCallback(window, [](GLFWwindow*, double x, double y) {
+        attached->on_event({Event::Type::SCROLL, 0, 0, 0, 0, x, y});
+    });
+}
+
+void Recording::on_event(const Event& event) {
+    // Live input would make the replay diverge
+    if (mode == Mode::REPLAY)
+        return;
+    if (mode == Mode::RECORD)
+        pending.push_back(event);
+    dispatch(event);
+}
+
+void Recording::dispatch(const Event& event) {
+    switch (event.type) {
+    case Event::Type::KEY:
+        if (key_callback)
+            key_callback(window, event.code, event.scancode, event.action, event.mods);
+        break;
+    case Event::Type::CHAR:
+        if (char_callback)
+            char_callback(window, event.code);
+        break;
+    case Event::Type::BUTTON:
+        if (button_callback)
+            button_callback(window, event.code, event.action, event.mods);
+        break;
+    case Event::Type::CURSOR:
+        if (cursor_callback)
+            cursor_callback(window, event.x, event.y);
+        break;
+    case Event::Type::SCROLL:
+        if (scroll_callback)
+            scroll_callback(window, event.x, event.y);
+        break;
+    }
+}
+
+float Recording::begin_frame(float dt) {
+    if (mode == Mode::RECORD) {
+        Frame frame{dt, std::move(pending)};
+        (*output)(frame);
+        pending.clear();
+    } else if (mode == Mode::REPLAY && next_frame < frames.size()) {
+        if (next_frame == 0)
+            replay_start = std::chrono::steady_clock::now();
+        if (!fast)
+            std::this_thread::sleep_until(
+                replay_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>(elapsed)));
+        auto& frame = frames[next_frame++];
+        for (auto& event : frame.events)
+            dispatch(event);
+        dt = frame.dt;
+    }
+    elapsed += dt;
+    frame_start = std::chrono::steady_clock::now();
+    return dt;
+}
+
+void Recording::end_frame() {
+    if (mode == Mode::OFF)
+        return;
+    frame_ms.push_back(std::chrono::duration<float, std::milli>(
+                           std::chrono::steady_clock::now() - frame_start)
+                           .count());
+}
+
+bool Recording::finished() const {
+    return mode == Mode::REPLAY && next_frame == frames.size();
+}
+
+void Recording::write_report(std::ostream& stream) const {
+    if (frame_ms.empty())
+        return;
+    auto sorted = frame_ms;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](float p) {
+        return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+    };
+    double total = 0;
+    for (auto ms : frame_ms)
+        total += ms;
+    nlohmann::json report = {{"frames", frame_ms.size()},
+                             {"mean_ms", total / frame_ms.size()},
+                             {"p50_ms", percentile(0.5f)},
+                             {"p90_ms", percentile(0.9f)},
+                             {"p99_ms", percentile(0.99f)},
+                             {"max_ms", sorted.back()},
+                             {"frame_ms", frame_ms}};
+    stream << report.dump(4) << std::endl;
+}
+
+void Recording::bind(Scripting& scripting) {
+    if (mode == Mode::OFF)
+        return;
+    auto& lua = scripting.lua;
+    lua["math"]["randomseed"](seed);
+    lua["time"] = [this]() { return start_time + int64_t(elapsed); };
+}
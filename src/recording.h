@@ -0,0 +1,92 @@
+#ifndef RECORDING_H_
+#define RECORDING_H_
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+#include <GLFW/glfw3.h>
+
+namespace cereal {
+    class BinaryOutputArchive;
+}
+
+struct Scripting;
+
+// Captures everything that makes a session nondeterministic, so it can be
+// played back on another build. File layout, written with cereal:
+//   magic | version | seed | start time | Frame...
+// Input polled after a frame is stored with the next one and dispatched at
+// its start on replay, before any system looks at it.
+struct Recording {
+    static constexpr uint32_t magic = 0x4345524d; // "MREC"
+    static constexpr uint32_t current_version = 1;
+
+    enum class Mode { OFF, RECORD, REPLAY };
+
+    struct Event {
+        enum class Type : uint8_t { KEY, CHAR, BUTTON, CURSOR, SCROLL };
+
+        Type type;
+        // Key, codepoint or mouse button
+        int32_t code = 0;
+        int32_t scancode = 0;
+        int32_t action = 0;
+        int32_t mods = 0;
+        double x = 0, y = 0;
+    };
+
+    struct Frame {
+        float dt;
+        std::vector<Event> events;
+    };
+
+    ~Recording();
+
+    bool record(const std::string& path);
+    // Fast replays run frames back to back instead of at the recorded pace
+    bool replay(const std::string& path, bool fast);
+    // Routes the window's input through the recording, call after every
+    // other callback is installed
+    void attach(GLFWwindow* window);
+    // Returns the dt to simulate, the recorded one when replaying
+    float begin_frame(float dt);
+    void end_frame();
+    bool finished() const;
+    // Per-frame times as JSON, one frame per line so reports diff cleanly
+    void write_report(std::ostream& stream) const;
+
+    // Seeds math.random and pins time() to the recorded clock
+    void bind(Scripting& scripting);
+
+    void on_event(const Event& event);
+    void dispatch(const Event& event);
+
+    Mode mode = Mode::OFF;
+    bool fast = false;
+    uint32_t seed = 0;
+    int64_t start_time = 0;
+    // Simulated seconds since the start
+    double elapsed = 0;
+
+    std::ofstream file;
+    std::unique_ptr<cereal::BinaryOutputArchive> output;
+    std::vector<Frame> frames;
+    size_t next_frame = 0;
+    std::vector<Event> pending;
+
+    std::chrono::steady_clock::time_point replay_start;
+    std::chrono::steady_clock::time_point frame_start;
+    std::vector<float> frame_ms;
+
+    GLFWwindow* window = nullptr;
+    GLFWkeyfun key_callback = nullptr;
+    GLFWcharfun char_callback = nullptr;
+    GLFWmousebuttonfun button_callback = nullptr;
+    GLFWcursorposfun cursor_callback = nullptr;
+    GLFWscrollfun scroll_callback = nullptr;
+};
+
+#endif // RECORDING_H_
@@ -0,0 +1,155 @@
+#include "script_shards.h"
+#include "entity.h"
+#include "profiler.h"
+#include "log.h"
+
+#include <algorithm>
+
+static ScriptShards::Value to_value(const sol::object& object) {
+    if (object.is<bool>())
+        return object.as<bool>();
+    if (object.is<double>())
+        return object.as<double>();
+    if (object.is<std::string>())
+        return object.as<std::string>();
+    throw sol::error("Messages carry booleans, numbers or strings");
+}
+
+static entt::entity to_entity(uint32_t id) {
+    return static_cast<entt::entity>(id);
+}
+
+ScriptShards::ScriptShards(entt::registry& _registry, size_t count)
+    : registry(_registry), loads(count, 0),
+      workers(count > 0 ? count - 1 : 0) {
+    for (size_t i = 0; i < count; i++) {
+        shards.push_back(std::make_unique<Shard>());
+        bind_shard(*shards.back());
+        shards.back()->scripting.lua["shard"] = i;
+    }
+}
+
+void ScriptShards::bind_engine(const std::function<void(Scripting&)>& bind) {
+    for (auto& shard : shards)
+        bind(shard->scripting);
+}
+
+void ScriptShards::bind_shard(Shard& shard) {
+    auto& lua = shard.scripting.lua;
+    lua["world"] = lua.create_table();
+    lua["world"]["transform"] = [this](uint32_t id) {
+        auto transform = registry.try_get<Transform>(to_entity(id));
+        if (!transform)
+            throw sol::error("Entity has no transform");
+        return *transform;
+    };
+    lua["world"]["set_transform"] = [&shard](uint32_t id, const Transform& transform) {
+        shard.writes.emplace_back(to_entity(id), transform);
+    };
+    lua["send"] = [&shard](uint32_t id, std::string name, sol::object value) {
+        shard.outbox.push_back({to_entity(id), std::move(name), to_value(value)});
+    };
+}
+
+void ScriptShards::run_scripts(const std::vector<Scripting::Script>& scripts) {
+    // On the main thread, so scripts may load assets while they start up
+    for (auto& shard : shards)
+        shard->scripting.run_scripts(scripts);
+}
+
+void ScriptShards::load_scripts(const std::string& path) {
+    if (!shards.empty())
+        run_scripts(Scripting::compile_scripts(path));
+}
+
+void ScriptShards::add(entt::entity entity) {
+    auto shard = std::min_element(loads.begin(), loads.end()) - loads.begin();
+    registry.emplace_or_replace<ScriptedEntity>(entity, uint32_t(shard));
+    loads[shard]++;
+}
+
+void ScriptShards::remove(entt::entity entity) {
+    registry.remove<ScriptedEntity>(entity);
+}
+
+void ScriptShards::send(Message message) {
+    pending.push_back(std::move(message));
+}
+
+void ScriptShards::run(Shard& shard, float dt) {
+    auto& lua = shard.scripting.lua;
+    auto report = [&](const sol::protected_function_result& result) {
+        if (!result.valid()) {
+            sol::error error = result;
+            shard.errors.push_back(error.what());
+        }
+    };
+    sol::protected_function receive = lua["receive"];
+    if (receive.valid())
+        for (auto& message : shard.inbox) {
+            auto value = std::visit([&](auto& v) { return sol::make_object(lua, v); },
+                                    message.value);
+            report(receive(uint32_t(message.target), message.name, value));
+        }
+    shard.inbox.clear();
+    sol::protected_function update = lua["update"];
+    if (update.valid())
+        for (auto entity : shard.entities)
+            report(update(uint32_t(entity), dt));
+    shard.scripting.step_gc();
+}
+
+void ScriptShards::update(float dt) {
+    if (shards.empty())
+        return;
+    PROFILE_ZONE("ScriptShards::update");
+    for (auto& shard : shards)
+        shard->entities.clear();
+    for (auto [entity, scripted] : registry.view<ScriptedEntity>().each())
+        shards[scripted.shard]->entities.push_back(entity);
+    for (size_t i = 0; i < shards.size(); i++)
+        loads[i] = shards[i]->entities.size();
+    // Routed here rather than by the senders, which only know the target
+    auto route = [&](std::vector<Message>& messages) {
+        for (auto& message : messages) {
+            auto scripted = registry.valid(message.target)
+                                ? registry.try_get<ScriptedEntity>(message.target)
+                                : nullptr;
+            if (scripted)
+                shards[scripted->shard]->inbox.push_back(std::move(message));
+        }
+        messages.clear();
+    };
+    route(pending);
+    for (auto& shard : shards)
+        route(shard->outbox);
+
+    // Each state is only ever used by one task at a time
+    workers.run(shards.size(), [&](size_t i) { run(*shards[i], dt); });
+
+    for (size_t i = 0; i < shards.size(); i++) {
+        auto& shard = shards[i];
+        for (auto& [entity, transform] : shard->writes)
+            if (registry.valid(entity) && registry.try_get<Transform>(entity))
+                registry.replace<Transform>(entity, transform);
+        shard->writes.clear();
+        for (auto& error : shard->errors)
+            LOG_ERROR(logger(LogChannel::SCRIPTING), "Script error shard={} error={}", i, error);
+        shard->errors.clear();
+    }
+}
+
+void ScriptShards::bind(Scripting& scripting) {
+    auto& lua = scripting.lua;
+    lua["shards"] = lua.create_table();
+    lua["shards"]["count"] = [this]() { return shards.size(); };
+    lua["shards"]["add"] = [this](Entity entity) {
+        if (shards.empty())
+            throw sol::error("Script shards are disabled");
+        add(entity.id);
+    };
+    lua["shards"]["remove"] = [this](Entity entity) { remove(entity.id); };
+    lua["shards"]["send"] = [this](Entity entity, std::string name, sol::object value) {
+        send({entity.id, std::move(name), to_value(value)});
+    };
+}
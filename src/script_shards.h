@@ -0,0 +1,80 @@
+#ifndef SCRIPT_SHARDS_H_
+#define SCRIPT_SHARDS_H_
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+#include <entt/entt.hpp>
+
+#include "scripting.h"
+#include "transform.h"
+#include "worker_pool.h"
+
+// Marks an entity as driven by the scripts of one shard
+struct ScriptedEntity {
+    uint32_t shard;
+};
+
+// Entity scripts spread over isolated Lua states that run in parallel, one
+// task per state. Every shard loads the same scripts, which define
+// update(id, dt) and optionally receive(id, name, value); entities are
+// passed as integer ids. While the shards run the registry is read-only:
+// world.transform(id) reads, world.set_transform(id, t) queues a write that
+// is applied once every shard is done, in shard order. send(id, name, value)
+// delivers a bool, number or string to whichever shard owns the target, at
+// the start of the next update. Shards run on persistent workers, one per
+// shard besides the main thread, so only bindings that neither load assets
+// nor touch Filament may be registered with bind_engine; handles would not
+// be safe either, since a worker may collect them.
+struct ScriptShards {
+    using Value = std::variant<bool, double, std::string>;
+
+    struct Message {
+        entt::entity target;
+        std::string name;
+        Value value;
+    };
+
+    struct Shard {
+        Scripting scripting;
+        std::vector<entt::entity> entities;
+        std::vector<Message> inbox;
+        std::vector<Message> outbox;
+        std::vector<std::pair<entt::entity, Transform>> writes;
+        std::vector<std::string> errors;
+    };
+
+    ScriptShards(entt::registry& registry, size_t count);
+
+    // Registers engine bindings in every shard, see above for which
+    void bind_engine(const std::function<void(Scripting&)>& bind);
+    // Compiled once, run in every shard
+    void run_scripts(const std::vector<Scripting::Script>& scripts);
+    void load_scripts(const std::string& path);
+    // Assigns an entity to the least loaded shard
+    void add(entt::entity entity);
+    void remove(entt::entity entity);
+    void send(Message message);
+    // Runs every shard's scripts, then applies their writes and routes
+    // their messages
+    void update(float dt);
+
+    // Exposes the shards to the main state
+    void bind(Scripting& scripting);
+
+    void bind_shard(Shard& shard);
+    void run(Shard& shard, float dt);
+
+    entt::registry& registry;
+    std::vector<std::unique_ptr<Shard>> shards;
+    // Entities per shard, as of the last update plus additions since
+    std::vector<size_t> loads;
+    // Sent from the main state since the last update
+    std::vector<Message> pending;
+    // Declared last, its threads stop before the states they run go away
+    WorkerPool workers;
+};
+
+#endif // SCRIPT_SHARDS_H_
@@ -1,19 +1,194 @@
 #include "scripting.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <span>
+#include <sstream>
 
-Scripting::Scripting() {
+#include "asset_library.h"
+#include "log.h"
+#include "profiler.h"
+#include <luajit.h>
+
+Scripting::Scripting()
+    : lua(sol::default_at_panic, &LuaAllocator::allocate, &allocator) {
     lua.open_libraries(sol::lib::base);
     lua.open_libraries(sol::lib::math);
+    lua.stop_gc();
     lua["time"] = []() { return std::time(nullptr); };
+    lua.new_usertype<GcStats>("GcStats", "heap_size", &GcStats::heap_size,
+                              "allocations", &GcStats::allocations,
+                              "step_time", &GcStats::step_time);
+    lua["gc_stats"] = [this]() { return gc_stats; };
+    lua["set_gc_budget"] = [this](float budget) { gc_budget = budget; };
 }
 
-void Scripting::load_scripts(const std::string& path) {
-    loaded.clear();
-    for (auto& p :
-         std::filesystem::recursive_directory_iterator("assets/scripts")) {
-        loaded.push_back({p.path(), std::filesystem::last_write_time(p)});
+// Cached bytecode layout: ScriptCacheHeader | source path | bytecode
+struct ScriptCacheHeader {
+    static constexpr uint32_t current_version = 2;
+    // LuaJIT's bytecode format is tied to its build, rolling releases put
+    // their commit time in the version string
+    static constexpr uint64_t current_luajit = hash_name(LUAJIT_VERSION);
+
+    char magic[4] = {'M', 'L', 'U', 'C'};
+    uint32_t version = current_version;
+    uint64_t luajit = current_luajit;
+    int64_t modtime = 0;
+    uint64_t content_hash = 0;
+    uint64_t path_size = 0;
+};
+
+static std::string cache_name(std::string_view path, const char* extension) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash_name(path));
+    return std::string("cache/scripts/") + name + extension;
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+// Splits a cache entry into its header and bytecode, if it is one
+static bool parse_cache(std::span<const char> data, const std::string& path,
+                        ScriptCacheHeader& header, std::string& bytecode) {
+    if (data.size() < sizeof(header))
+        return false;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, ScriptCacheHeader().magic, 4) != 0 ||
+        header.version != ScriptCacheHeader::current_version ||
+        header.luajit != ScriptCacheHeader::current_luajit ||
+        data.size() < sizeof(header) + header.path_size ||
+        std::string_view(data.data() + sizeof(header), header.path_size) != path)
+        return false;
+    auto offset = sizeof(header) + header.path_size;
+    bytecode.assign(data.data() + offset, data.size() - offset);
+    return true;
+}
+
+static void write_cache(const std::string& filename, ScriptCacheHeader header,
+                        const std::string& path, const std::string& bytecode) {
+    std::ofstream file(filename, std::ios::binary);
+    header.path_size = path.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file << path << bytecode;
+}
+
+std::vector<Scripting::Script> Scripting::compile_scripts(const std::string& path) {
+    PROFILE_ZONE("Scripting::compile_scripts");
+    std::vector<Script> scripts;
+    auto index_name = cache_name(path, ".index");
+    if (!std::filesystem::exists(path)) {
+        // Shipped without sources, run what the index lists from the archive
+        AssetArchive archive;
+        if (!archive.open("assets.pak")) {
+            LOG_ERROR(logger(LogChannel::SCRIPTING), "No script sources and no archive path={}", path);
+            scripts.push_back({path, {}, {}, "No sources and no assets.pak for '" + path + "'"});
+            return scripts;
+        }
+        auto index = archive.read(index_name);
+        if (!index) {
+            LOG_ERROR(logger(LogChannel::SCRIPTING), "No script index in archive path={}", path);
+            scripts.push_back({path, {}, {}, "No script index for '" + path + "' in assets.pak"});
+            return scripts;
+        }
+        std::istringstream lines(std::string(index.bytes.begin(), index.bytes.end()));
+        for (std::string script_path; std::getline(lines, script_path);) {
+            auto& script = scripts.emplace_back(Script{script_path});
+            ScriptCacheHeader header;
+            auto data = archive.read(cache_name(script_path, ".luac"));
+            if (!parse_cache(data.bytes, script_path, header, script.bytecode))
+                script.error = "No bytecode for '" + script_path + "' from this LuaJIT build";
+        }
+        return scripts;
+    }
+
+    for (auto& p : std::filesystem::recursive_directory_iterator(path))
+        if (p.is_regular_file())
+            scripts.push_back({p.path(), std::filesystem::last_write_time(p)});
+    std::sort(scripts.begin(), scripts.end(), [](auto& a, auto& b) { return a.path < b.path; });
+    std::filesystem::create_directories("assets/cache/scripts");
+    lua_State* state = nullptr;
+    std::string index;
+    for (auto& script : scripts) {
+        index += script.path + '\n';
+        auto filename = "assets/" + cache_name(script.path, ".luac");
+        auto cached = read_file(filename);
+        ScriptCacheHeader header;
+        bool valid = parse_cache(cached, script.path, header, script.bytecode);
+        int64_t modtime = script.last_modtime.time_since_epoch().count();
+        if (valid && header.modtime == modtime)
+            continue;
+        // Touched but maybe not changed, e.g. by a checkout
+        auto source = read_file(script.path);
+        auto content_hash = hash_name(source);
+        if (valid && header.content_hash == content_hash) {
+            header.modtime = modtime;
+            write_cache(filename, header, script.path, script.bytecode);
+            continue;
+        }
+        if (!state)
+            state = luaL_newstate();
+        script.bytecode.clear();
+        auto chunk_name = "@" + script.path;
+        if (luaL_loadbuffer(state, source.data(), source.size(), chunk_name.c_str()) != 0) {
+            script.error = lua_tostring(state, -1);
+        } else {
+            lua_dump(state, [](lua_State*, const void* data, size_t size, void* bytecode) {
+                static_cast<std::string*>(bytecode)->append(static_cast<const char*>(data), size);
+                return 0;
+            }, &script.bytecode);
+            ScriptCacheHeader fresh;
+            fresh.modtime = modtime;
+            fresh.content_hash = content_hash;
+            write_cache(filename, fresh, script.path, script.bytecode);
+        }
+        lua_pop(state, 1);
+    }
+    if (state)
+        lua_close(state);
+    if (read_file("assets/" + index_name) != index)
+        std::ofstream("assets/" + index_name, std::ios::binary) << index;
+    return scripts;
+}
+
+void Scripting::run_scripts(std::vector<Script> scripts) {
+    loaded = std::move(scripts);
+    for (auto& script : loaded) {
+        PROFILE_ZONE("Scripting::run_script");
+        if (!script.error.empty())
+            throw sol::error(script.error);
+        // Dumped with its chunk name, errors still point at the file
+        lua.script(script.bytecode);
+        script.bytecode.clear();
+        script.bytecode.shrink_to_fit();
     }
-    std::sort(loaded.begin(), loaded.end(), [](auto& a, auto& b) { return a.path < b.path; });
-    for (const auto& script : loaded)
-        lua.script_file(script.path);
+}
+
+void Scripting::load_scripts(const std::string& path) {
+    run_scripts(compile_scripts(path));
+}
+
+void Scripting::step_gc() {
+    PROFILE_ZONE("Scripting::step_gc");
+    auto start = std::chrono::high_resolution_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                                std::chrono::duration<float>(gc_budget));
+    auto now = start;
+    do {
+        if (lua.step_gc(gc_step_size))
+            break;
+        now = std::chrono::high_resolution_clock::now();
+    } while (now < deadline);
+    // LUA_GCSTEP resets the threshold, which turns the automatic collector
+    // back on; without this it would run again inside the next frame's calls
+    lua.stop_gc();
+    now = std::chrono::high_resolution_clock::now();
+    gc_stats.heap_size = allocator.heap_size;
+    gc_stats.allocations = allocator.allocations;
+    gc_stats.step_time = std::chrono::duration_cast<std::chrono::duration<float>>(now - start).count();
+    allocator.allocations = 0;
 }
@@ -5,18 +5,42 @@
 #include <filesystem>
 #include <sol/sol.hpp>
 #include <string>
+#include <vector>
+
+#include "lua_allocator.h"
 
 struct Scripting {
     struct Script {
         std::string path;
         std::filesystem::file_time_type last_modtime;
+        // Until the script runs, or the syntax error
+        std::string bytecode;
+        std::string error;
+    };
+
+    struct GcStats {
+        size_t heap_size = 0;
+        size_t allocations = 0;
+        float step_time = 0;
     };
 
     Scripting();
+    // Parses every script under path into bytecode in a scratch state, safe
+    // to call from any thread
+    static std::vector<Script> compile_scripts(const std::string& path);
+    // Runs compiled scripts in path order
+    void run_scripts(std::vector<Script> scripts);
     void load_scripts(const std::string& path);
+    // Runs incremental GC steps until the cycle ends or the budget runs out
+    void step_gc();
 
+    LuaAllocator allocator;
     sol::state lua;
     std::vector<Script> loaded;
+
+    float gc_budget = 0.001f;
+    int gc_step_size = 4;
+    GcStats gc_stats;
 };
 
 #endif // SCRIPTING_H_
@@ -0,0 +1,318 @@
+#include "snapshot.h"
+#include "animator.h"
+#include "entity.h"
+#include "graphics.h"
+#include "model.h"
+#include "profiler.h"
+#include "scripting.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/common.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cereal {
+    template <typename Archive, typename T>
+    void serialize(Archive& archive, filament::math::details::TVec3<T>& v) {
+        archive(v.x, v.y, v.z);
+    }
+
+    template <typename Archive, typename T>
+    void serialize(Archive& archive, filament::math::details::TVec4<T>& v) {
+        archive(v.x, v.y, v.z, v.w);
+    }
+
+    template <typename Archive, typename T>
+    void serialize(Archive& archive, filament::math::details::TQuaternion<T>& q) {
+        archive(q.x, q.y, q.z, q.w);
+    }
+
+    template <typename Archive> void serialize(Archive& archive, AssetId& id) {
+        archive(id.hash);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive, MaterialParameter& parameter) {
+        archive(parameter.name, parameter.components, parameter.value);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive, Transform& transform) {
+        archive(transform.position, transform.scale, transform.rotation);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive, Snapshot::RenderableRecord& record) {
+        archive(record.model, record.overrides);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive, Snapshot::AnimationRecord& record) {
+        archive(record.model, record.animation, record.time_ratio);
+    }
+
+    template <typename Archive, typename Record>
+    void serialize(Archive& archive, Snapshot::Column<Record>& column) {
+        archive(column.entities, column.records);
+    }
+}
+
+Snapshot Snapshot::capture(entt::registry& registry,
+                           const std::function<bool(entt::entity)>& filter) {
+    PROFILE_ZONE("Snapshot::capture");
+    Snapshot snapshot;
+    std::unordered_map<entt::entity, uint32_t> indices;
+    auto skip = [&](entt::entity entity) { return filter && !filter(entity); };
+    auto index = [&](entt::entity entity) {
+        auto [it, inserted] = indices.try_emplace(entity, snapshot.entity_count);
+        if (inserted)
+            ++snapshot.entity_count;
+        return it->second;
+    };
+    std::unordered_set<AssetId> ids;
+
+    for (auto [entity, transform] : registry.view<Transform>().each()) {
+        if (skip(entity))
+            continue;
+        snapshot.transforms.entities.push_back(index(entity));
+        snapshot.transforms.records.push_back(transform);
+    }
+    for (auto [entity, renderable] : registry.view<Renderable>().each()) {
+        if (skip(entity))
+            continue;
+        snapshot.renderables.entities.push_back(index(entity));
+        snapshot.renderables.records.push_back(
+            {renderable.model.id(), renderable.overrides.parameters});
+        ids.insert(renderable.model.id());
+        for (auto& parameter : renderable.overrides.parameters)
+            ids.insert(parameter.name);
+    }
+    for (auto [entity, animation] : registry.view<SkeletalAnimation>().each()) {
+        if (skip(entity))
+            continue;
+        snapshot.animations.entities.push_back(index(entity));
+        snapshot.animations.records.push_back(
+            {animation.model.id(), animation.animation.id(), animation.time_ratio});
+        ids.insert(animation.model.id());
+        ids.insert(animation.animation.id());
+    }
+    for (auto entity : registry.view<Sun>()) {
+        if (skip(entity))
+            continue;
+        snapshot.lights.entities.push_back(index(entity));
+        snapshot.lights.records.push_back(Light::SUN);
+    }
+    for (auto entity : registry.view<DirectionalLight>()) {
+        if (skip(entity))
+            continue;
+        snapshot.lights.entities.push_back(index(entity));
+        snapshot.lights.records.push_back(Light::DIRECTIONAL);
+    }
+    for (auto id : ids)
+        snapshot.names.push_back(asset_name(id));
+    return snapshot;
+}
+
+// Every index instantiate will use must name one of the snapshot's
+// entities, and no entity may have a component twice
+template <typename Record>
+static bool valid_column(const Snapshot::Column<Record>& column,
+                         uint32_t entity_count, std::vector<bool>& seen) {
+    if (column.entities.size() != column.records.size())
+        return false;
+    std::fill(seen.begin(), seen.end(), false);
+    for (auto entity : column.entities) {
+        if (entity >= entity_count || seen[entity])
+            return false;
+        seen[entity] = true;
+    }
+    return true;
+}
+
+bool Snapshot::validate() const {
+    // Capture only numbers entities that own a record
+    auto records = transforms.entities.size() + renderables.entities.size() +
+                   animations.entities.size() + lights.entities.size();
+    if (entity_count > records)
+        return false;
+    std::vector<bool> seen(entity_count);
+    if (!valid_column(transforms, entity_count, seen) ||
+        !valid_column(renderables, entity_count, seen) ||
+        !valid_column(animations, entity_count, seen) ||
+        !valid_column(lights, entity_count, seen))
+        return false;
+    // instantiate resolves ids through asset_name, which exits on an unknown
+    // one, so every id must come with its name
+    std::unordered_set<AssetId> known;
+    for (auto& name : names)
+        known.insert(AssetId(name));
+    for (auto& record : renderables.records) {
+        if (!known.contains(record.model))
+            return false;
+        for (auto& parameter : record.overrides)
+            if (!known.contains(parameter.name) || parameter.components < 1 ||
+                parameter.components > 4)
+                return false;
+    }
+    for (auto& record : animations.records)
+        if (!known.contains(record.model) || !known.contains(record.animation))
+            return false;
+    for (auto light : lights.records)
+        if (light != Light::SUN && light != Light::DIRECTIONAL)
+            return false;
+    return true;
+}
+
+bool Snapshot::read(std::istream& stream) {
+    PROFILE_ZONE("Snapshot::read");
+    try {
+        cereal::BinaryInputArchive archive(stream);
+        uint32_t file_magic, version;
+        archive(file_magic, version);
+        if (file_magic != magic || version != current_version) {
+            LOG_ERROR(logger(LogChannel::ENGINE), "Unsupported snapshot version={}", version);
+            return false;
+        }
+        archive(entity_count, names, transforms, renderables, animations,
+                lights);
+    } catch (cereal::Exception& e) {
+        LOG_ERROR(logger(LogChannel::ENGINE), "Malformed snapshot error={}", e.what());
+        return false;
+    }
+    if (!validate()) {
+        LOG_ERROR(logger(LogChannel::ENGINE), "Malformed snapshot error=inconsistent columns or unknown asset id");
+        return false;
+    }
+    for (auto& name : names)
+        intern_asset(name);
+    return true;
+}
+
+void Snapshot::write(std::ostream& stream) const {
+    PROFILE_ZONE("Snapshot::write");
+    cereal::BinaryOutputArchive archive(stream);
+    archive(magic, current_version, entity_count, names, transforms,
+            renderables, animations, lights);
+}
+
+std::vector<entt::entity> Snapshot::instantiate(entt::registry& registry,
+                                                Graphics& graphics,
+                                                AssetLibrary& assets) const {
+    PROFILE_ZONE("Snapshot::instantiate");
+    std::vector<entt::entity> created(entity_count);
+    registry.create(created.begin(), created.end());
+
+    // Each asset is looked up once however many entities refer to it
+    std::unordered_map<AssetId, ModelHandle> models;
+    auto model = [&](AssetId id) -> ModelHandle& {
+        auto it = models.find(id);
+        if (it == models.end())
+            it = models.emplace(id, assets.models[id]).first;
+        return it->second;
+    };
+
+    for (size_t i = 0; i < transforms.records.size(); i++)
+        registry.emplace<Transform>(created[transforms.entities[i]],
+                                    transforms.records[i]);
+
+    // Renderables without overrides are built in one batch per model
+    std::unordered_map<AssetId, std::vector<entt::entity>> batches;
+    for (size_t i = 0; i < renderables.records.size(); i++) {
+        auto& record = renderables.records[i];
+        auto entity = created[renderables.entities[i]];
+        if (record.overrides.empty())
+            batches[record.model].push_back(entity);
+        else
+            registry.emplace<Renderable>(entity, graphics, model(record.model),
+                                         MaterialOverrides{record.overrides});
+    }
+    for (auto& [id, entities] : batches) {
+        auto& handle = model(id);
+        auto built = graphics.create_renderables(*handle, entities.size());
+        for (size_t i = 0; i < entities.size(); i++)
+            registry.emplace<Renderable>(entities[i], graphics, built[i], handle);
+    }
+
+    for (size_t i = 0; i < animations.records.size(); i++) {
+        auto& record = animations.records[i];
+        auto& animation = registry.emplace<SkeletalAnimation>(
+            created[animations.entities[i]], model(record.model),
+            assets.animations[record.animation]);
+        animation.time_ratio = record.time_ratio;
+    }
+
+    for (size_t i = 0; i < lights.records.size(); i++) {
+        auto entity = created[lights.entities[i]];
+        if (lights.records[i] == Light::SUN)
+            registry.emplace<Sun>(entity, graphics);
+        else
+            registry.emplace<DirectionalLight>(entity, graphics);
+    }
+    return created;
+}
+
+void Snapshot::destroy(entt::registry& registry, Graphics& graphics,
+                       std::span<const entt::entity> entities) {
+    auto& engine = *graphics.engine;
+    auto destroy_entity = [&](utils::Entity entity) {
+        graphics.scene->remove(entity);
+        engine.destroy(entity);
+        utils::EntityManager::get().destroy(entity);
+    };
+    for (auto entity : entities) {
+        if (auto sun = registry.try_get<Sun>(entity))
+            destroy_entity(sun->entity);
+        if (auto light = registry.try_get<DirectionalLight>(entity))
+            destroy_entity(light->entity);
+    }
+    registry.destroy(entities.begin(), entities.end());
+}
+
+void Snapshot::clear(entt::registry& registry, Graphics& graphics) {
+    std::vector<entt::entity> entities;
+    registry.each([&](auto entity) { entities.push_back(entity); });
+    destroy(registry, graphics, entities);
+}
+
+void Snapshot::bind(Scripting& scripting, entt::registry& registry,
+                    Graphics& graphics, AssetLibrary& assets) {
+    auto& lua = scripting.lua;
+    lua["snapshot"] = lua.create_table();
+    lua["snapshot"]["save"] = [&registry](const std::string& path) {
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+            throw sol::error("Failed to open '" + path + "'");
+        capture(registry).write(file);
+    };
+    auto read = [](const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        Snapshot snapshot;
+        if (!file || !snapshot.read(file))
+            throw sol::error("Failed to read snapshot '" + path + "'");
+        return snapshot;
+    };
+    auto instantiate = [&registry, &graphics, &assets](const Snapshot& snapshot,
+                                                       sol::this_state state) {
+        auto entities = snapshot.instantiate(registry, graphics, assets);
+        auto result = sol::state_view(state).create_table(entities.size(), 0);
+        for (size_t i = 0; i < entities.size(); i++)
+            result[i + 1] = Entity{entities[i]};
+        return result;
+    };
+    lua["snapshot"]["load"] = [read, instantiate](const std::string& path,
+                                                  sol::this_state state) {
+        return instantiate(read(path), state);
+    };
+    // Replaces the whole scene, for quick save and restore
+    lua["snapshot"]["restore"] = [&registry, &graphics, read, instantiate](
+                                     const std::string& path, sol::this_state state) {
+        auto snapshot = read(path);
+        clear(registry, graphics);
+        return instantiate(snapshot, state);
+    };
+}
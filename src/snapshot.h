@@ -0,0 +1,76 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <span>
+#include <string>
+#include <vector>
+#include <entt/entt.hpp>
+
+#include "asset_library.h"
+#include "material.h"
+#include "transform.h"
+
+struct Graphics;
+struct Scripting;
+
+// Registry contents as plain data. Entities are indices into the snapshot
+// and assets are ids, so reading needs neither the registry nor the asset
+// library and may happen on any thread; instantiate resolves everything on
+// the main thread.
+struct Snapshot {
+    static constexpr uint32_t magic = 0x504e534d; // "MSNP"
+    static constexpr uint32_t current_version = 1;
+
+    // One column per component type, entities[i] owns the i-th record
+    template <typename Record> struct Column {
+        std::vector<uint32_t> entities;
+        std::vector<Record> records;
+    };
+
+    struct RenderableRecord {
+        AssetId model;
+        std::vector<MaterialParameter> overrides;
+    };
+
+    struct AnimationRecord {
+        AssetId model;
+        AssetId animation;
+        float time_ratio;
+    };
+
+    enum class Light : uint8_t { SUN, DIRECTIONAL };
+
+    // Captures the entities passing filter, or all of them without one
+    static Snapshot capture(entt::registry& registry,
+                            const std::function<bool(entt::entity)>& filter = {});
+    // Logs and returns false on malformed or outdated data
+    bool read(std::istream& stream);
+    // Whether every column's indices and sizes are consistent and every
+    // asset id in the records is one of names
+    bool validate() const;
+    void write(std::ostream& stream) const;
+    // Creates the snapshot's entities, loading any assets they reference
+    std::vector<entt::entity> instantiate(entt::registry& registry,
+                                          Graphics& graphics,
+                                          AssetLibrary& assets) const;
+    // Destroys entities along with their lights; renderables are released
+    // by the hook Graphics::track_renderables installs
+    static void destroy(entt::registry& registry, Graphics& graphics,
+                        std::span<const entt::entity> entities);
+    static void clear(entt::registry& registry, Graphics& graphics);
+
+    static void bind(Scripting& scripting, entt::registry& registry,
+                     Graphics& graphics, AssetLibrary& assets);
+
+    uint32_t entity_count = 0;
+    // Every asset name the records refer to, interned on read
+    std::vector<std::string> names;
+    Column<Transform> transforms;
+    Column<RenderableRecord> renderables;
+    Column<AnimationRecord> animations;
+    Column<Light> lights;
+};
+
+#endif // SNAPSHOT_H_
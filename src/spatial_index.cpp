@@ -0,0 +1,295 @@
+#include "spatial_index.h"
+#include "entity.h"
+#include "graphics.h"
+#include "mesh.h"
+#include "model.h"
+#include "profiler.h"
+#include "scripting.h"
+#include "transform.h"
+#include "worker_pool.h"
+#include <filament/Frustum.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+static int64_t cell_key(Vec3i c) {
+    constexpr int64_t mask = (int64_t(1) << 21) - 1;
+    return (c.x & mask) << 42 | (c.y & mask) << 21 | (c.z & mask);
+}
+
+SpatialIndex::SpatialIndex(entt::registry& _registry, float _cell_size)
+    : registry(_registry), cell_size(_cell_size) {
+    registry.on_construct<Transform>().connect<&SpatialIndex::on_construct>(*this);
+    registry.on_destroy<Transform>().connect<&SpatialIndex::on_destroy>(*this);
+    for (auto entity : registry.view<Transform>())
+        on_construct(registry, entity);
+}
+
+SpatialIndex::~SpatialIndex() {
+    registry.on_construct<Transform>().disconnect<&SpatialIndex::on_construct>(*this);
+    registry.on_destroy<Transform>().disconnect<&SpatialIndex::on_destroy>(*this);
+}
+
+Vec3i SpatialIndex::coordinates(Vec3f position) const {
+    return Vec3i(floor(position / cell_size));
+}
+
+void SpatialIndex::on_construct(entt::registry& registry, entt::entity entity) {
+    auto position = registry.get<Transform>(entity).position;
+    slots.emplace(entity, items.size());
+    items.push_back({entity, position, 0, cell_key(coordinates(position))});
+    insert(items.size() - 1);
+}
+
+void SpatialIndex::on_destroy(entt::registry& registry, entt::entity entity) {
+    auto it = slots.find(entity);
+    auto slot = it->second;
+    slots.erase(it);
+    erase(slot);
+    uint32_t last = items.size() - 1;
+    if (slot != last) {
+        auto& moved = cells[items[last].cell].slots;
+        *std::find(moved.begin(), moved.end(), last) = slot;
+        items[slot] = items[last];
+        slots[items[slot].entity] = slot;
+    }
+    items.pop_back();
+}
+
+void SpatialIndex::insert(uint32_t slot) {
+    auto& cell = cells[items[slot].cell];
+    if (cell.slots.empty())
+        cell.coordinates = coordinates(items[slot].center);
+    cell.slots.push_back(slot);
+}
+
+void SpatialIndex::erase(uint32_t slot) {
+    auto it = cells.find(items[slot].cell);
+    auto& cell_slots = it->second.slots;
+    *std::find(cell_slots.begin(), cell_slots.end(), slot) = cell_slots.back();
+    cell_slots.pop_back();
+    if (cell_slots.empty())
+        cells.erase(it);
+}
+
+void SpatialIndex::update() {
+    PROFILE_ZONE("SpatialIndex::update");
+    // Creates the pools up front, lookups from the workers must not
+    (void)registry.view<Transform, Renderable>();
+
+    std::vector<int64_t> new_cells(items.size());
+    auto& pool = WorkerPool::get();
+    const size_t min_chunk = 1024;
+    size_t chunks = std::clamp<size_t>(items.size() / min_chunk, 1, pool.concurrency());
+    size_t chunk = (items.size() + chunks - 1) / chunks;
+    std::vector<float> radii(chunks, 0);
+    pool.run(chunks, [&](size_t c) {
+        for (size_t i = c * chunk; i < std::min((c + 1) * chunk, items.size()); i++) {
+            auto& item = items[i];
+            auto& transform = registry.get<Transform>(item.entity);
+            item.center = transform.position;
+            auto renderable = registry.try_get<Renderable>(item.entity);
+            auto& scale = transform.scale;
+            item.radius = renderable ? renderable->model->mesh->radius *
+                                           std::max({scale.x, scale.y, scale.z})
+                                     : 0;
+            radii[c] = std::max(radii[c], item.radius);
+            new_cells[i] = cell_key(coordinates(item.center));
+        }
+    });
+    max_radius = *std::max_element(radii.begin(), radii.end());
+
+    std::vector<uint32_t> moved;
+    for (uint32_t i = 0; i < items.size(); i++)
+        if (new_cells[i] != items[i].cell)
+            moved.push_back(i);
+    if (moved.size() <= rebuild_ratio * items.size()) {
+        for (auto i : moved) {
+            erase(i);
+            items[i].cell = new_cells[i];
+            insert(i);
+        }
+        return;
+    }
+
+    // Rebuilt in partitions of the cell keys: each chunk sorts its slots
+    // into partitions, then each partition fills its own map from every
+    // chunk in order, so slots stay ascending within a cell. The maps are
+    // spliced together at the end, moving nodes rather than slots.
+    PROFILE_ZONE("SpatialIndex::rebuild");
+    size_t partitions = pool.concurrency();
+    std::vector<std::vector<std::vector<uint32_t>>> split(
+        chunks, std::vector<std::vector<uint32_t>>(partitions));
+    pool.run(chunks, [&](size_t c) {
+        for (size_t i = c * chunk; i < std::min((c + 1) * chunk, items.size()); i++) {
+            items[i].cell = new_cells[i];
+            split[c][std::hash<int64_t>()(new_cells[i]) % partitions].push_back(i);
+        }
+    });
+    std::vector<std::unordered_map<int64_t, Cell>> filled(partitions);
+    pool.run(partitions, [&](size_t p) {
+        for (auto& chunk_slots : split)
+            for (auto slot : chunk_slots[p]) {
+                auto& cell = filled[p][items[slot].cell];
+                if (cell.slots.empty())
+                    cell.coordinates = coordinates(items[slot].center);
+                cell.slots.push_back(slot);
+            }
+    });
+    cells.clear();
+    for (auto& partition : filled)
+        cells.merge(partition);
+}
+
+template <typename Visit>
+void SpatialIndex::for_cells(Vec3f min, Vec3f max, Visit&& visit) const {
+    auto low = coordinates(min), high = coordinates(max);
+    auto extent = high - low + 1;
+    // A huge box is cheaper to test against every occupied cell
+    if (uint64_t(extent.x) * extent.y * extent.z > cells.size()) {
+        for (auto& [key, cell] : cells) {
+            auto& c = cell.coordinates;
+            if (c.x >= low.x && c.y >= low.y && c.z >= low.z &&
+                c.x <= high.x && c.y <= high.y && c.z <= high.z)
+                visit(cell);
+        }
+        return;
+    }
+    for (int x = low.x; x <= high.x; x++)
+        for (int y = low.y; y <= high.y; y++)
+            for (int z = low.z; z <= high.z; z++)
+                if (auto it = cells.find(cell_key({x, y, z})); it != cells.end())
+                    visit(it->second);
+}
+
+void SpatialIndex::query_radius(Vec3f center, float radius,
+                                std::vector<entt::entity>& results) const {
+    Vec3f reach(radius + max_radius);
+    for_cells(center - reach, center + reach, [&](const Cell& cell) {
+        for (auto slot : cell.slots) {
+            auto& item = items[slot];
+            if (distance(center, item.center) <= radius + item.radius)
+                results.push_back(item.entity);
+        }
+    });
+}
+
+void SpatialIndex::query_box(Vec3f min, Vec3f max,
+                             std::vector<entt::entity>& results) const {
+    Vec3f reach(max_radius);
+    for_cells(min - reach, max + reach, [&](const Cell& cell) {
+        for (auto slot : cell.slots) {
+            auto& item = items[slot];
+            auto closest = clamp(item.center, min, max);
+            if (distance(closest, item.center) <= item.radius)
+                results.push_back(item.entity);
+        }
+    });
+}
+
+void SpatialIndex::query_frustum(const filament::Frustum& frustum,
+                                 std::vector<entt::entity>& results) const {
+    // Half the cell diagonal
+    float cell_radius = cell_size * 0.8660254f + max_radius;
+    for (auto& [key, cell] : cells) {
+        Vec3f center = (Vec3f(cell.coordinates) + 0.5f) * cell_size;
+        if (!frustum.intersects(Vec4f(center, cell_radius)))
+            continue;
+        for (auto slot : cell.slots) {
+            auto& item = items[slot];
+            if (frustum.intersects(Vec4f(item.center, item.radius)))
+                results.push_back(item.entity);
+        }
+    }
+}
+
+void SpatialIndex::query_nearest(Vec3f center, size_t k,
+                                 std::vector<entt::entity>& results) const {
+    if (k == 0)
+        return;
+    std::priority_queue<std::pair<float, entt::entity>> best;
+    auto visit_cell = [&](const Cell& cell) {
+        for (auto slot : cell.slots) {
+            auto& item = items[slot];
+            float d = distance(center, item.center);
+            if (best.size() < k)
+                best.emplace(d, item.entity);
+            else if (d < best.top().first) {
+                best.pop();
+                best.emplace(d, item.entity);
+            }
+        }
+    };
+    auto visit = [&](Vec3i c) {
+        auto it = cells.find(cell_key(c));
+        if (it == cells.end())
+            return false;
+        visit_cell(it->second);
+        return true;
+    };
+    // Grows a shell of cells around the center until nothing closer can be
+    // left or every occupied cell was seen
+    auto origin = coordinates(center);
+    size_t visited = 0;
+    for (int r = 0; visited < cells.size(); r++) {
+        if (best.size() == k && (r - 1) * cell_size > best.top().first)
+            break;
+        // Past this the shells cost more than testing every occupied cell,
+        // visit those outside the rings seen so far and stop
+        uint64_t side = 2 * r + 1;
+        if (side * side * side > cells.size()) {
+            for (auto& [key, cell] : cells) {
+                auto offset = cell.coordinates - origin;
+                if (std::max({std::abs(offset.x), std::abs(offset.y), std::abs(offset.z)}) >= r)
+                    visit_cell(cell);
+            }
+            break;
+        }
+        for (int x = -r; x <= r; x++)
+            for (int y = -r; y <= r; y++) {
+                bool face = std::abs(x) == r || std::abs(y) == r;
+                for (int z = -r; z <= r; z += face || r == 0 ? 1 : 2 * r)
+                    visited += visit(origin + Vec3i{x, y, z});
+            }
+    }
+    size_t first = results.size();
+    for (; !best.empty(); best.pop())
+        results.push_back(best.top().second);
+    std::reverse(results.begin() + first, results.end());
+}
+
+void SpatialIndex::bind(Scripting& scripting, Graphics& graphics) {
+    auto& lua = scripting.lua;
+    auto to_table = [](const std::vector<entt::entity>& entities,
+                       sol::this_state state) {
+        auto table = sol::state_view(state).create_table(entities.size(), 0);
+        for (size_t i = 0; i < entities.size(); i++)
+            table[i + 1] = Entity{entities[i]};
+        return table;
+    };
+    lua["spatial"] = lua.create_table();
+    lua["spatial"]["radius"] = [this, to_table](Vec3f center, float radius, sol::this_state state) {
+        std::vector<entt::entity> results;
+        query_radius(center, radius, results);
+        return to_table(results, state);
+    };
+    lua["spatial"]["box"] = [this, to_table](Vec3f min, Vec3f max, sol::this_state state) {
+        std::vector<entt::entity> results;
+        query_box(min, max, results);
+        return to_table(results, state);
+    };
+    lua["spatial"]["nearest"] = [this, to_table](Vec3f center, size_t k, sol::this_state state) {
+        std::vector<entt::entity> results;
+        query_nearest(center, k, results);
+        return to_table(results, state);
+    };
+    // Entities in view of the first camera, the on-screen one if any
+    lua["spatial"]["visible"] = [this, to_table, &graphics](sol::this_state state) {
+        auto& views = graphics.views.empty() ? graphics.offscreen_views : graphics.views;
+        std::vector<entt::entity> results;
+        if (!views.empty())
+            query_frustum(views.front()->getCamera().getFrustum(), results);
+        return to_table(results, state);
+    };
+}
@@ -0,0 +1,73 @@
+#ifndef SPATIAL_INDEX_H_
+#define SPATIAL_INDEX_H_
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <entt/entt.hpp>
+
+#include "primitives.h"
+
+namespace filament {
+    class Frustum;
+}
+
+struct Graphics;
+struct Scripting;
+
+// Loose grid over the bounding spheres of entities with a Transform. Each
+// entity lives in the cell holding its center and queries widen their search
+// by the largest radius, so nothing is ever split across cells. Queries
+// append to results, so callers can reuse one vector across frames.
+struct SpatialIndex {
+    struct Item {
+        entt::entity entity;
+        Vec3f center;
+        float radius;
+        int64_t cell;
+    };
+
+    struct Cell {
+        Vec3i coordinates;
+        std::vector<uint32_t> slots;
+    };
+
+    SpatialIndex(entt::registry& registry, float cell_size = 8);
+    ~SpatialIndex();
+
+    // Refreshes bounds from transforms on the worker pool, then moves the
+    // entities that changed cell, or refills every cell in parallel if more
+    // than rebuild_ratio of them did
+    void update();
+
+    void query_radius(Vec3f center, float radius,
+                      std::vector<entt::entity>& results) const;
+    void query_box(Vec3f min, Vec3f max,
+                   std::vector<entt::entity>& results) const;
+    // Sphere against frustum, enough for culling and picking LODs by distance
+    void query_frustum(const filament::Frustum& frustum,
+                       std::vector<entt::entity>& results) const;
+    // Up to k entities, nearest center first
+    void query_nearest(Vec3f center, size_t k,
+                       std::vector<entt::entity>& results) const;
+
+    void bind(Scripting& scripting, Graphics& graphics);
+
+    void on_construct(entt::registry& registry, entt::entity entity);
+    void on_destroy(entt::registry& registry, entt::entity entity);
+    Vec3i coordinates(Vec3f position) const;
+    // Visits the occupied cells overlapping a box
+    template <typename Visit>
+    void for_cells(Vec3f min, Vec3f max, Visit&& visit) const;
+    void insert(uint32_t slot);
+    void erase(uint32_t slot);
+
+    entt::registry& registry;
+    float cell_size;
+    float rebuild_ratio = 0.25f;
+    float max_radius = 0;
+    std::vector<Item> items;
+    std::unordered_map<entt::entity, uint32_t> slots;
+    std::unordered_map<int64_t, Cell> cells;
+};
+
+#endif // SPATIAL_INDEX_H_
@@ -0,0 +1,68 @@
+#include "startup.h"
+#include "profiler.h"
+
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+Startup::~Startup() {
+    // Workers reference state owned by main, none may outlive it
+    for (auto& step : steps)
+        if (step.done.valid())
+            step.done.wait();
+}
+
+Startup::StepId Startup::async(std::string name, std::vector<StepId> dependencies,
+                               std::function<void()> run) {
+    std::vector<std::shared_future<void>> waits;
+    for (auto dependency : dependencies)
+        waits.push_back(steps[dependency].done);
+    auto& step = steps.emplace_back();
+    step.name = std::move(name);
+    step.thread = ++workers;
+    step.done = std::async(std::launch::async, [&step, waits = std::move(waits),
+                                                run = std::move(run)] {
+                    for (auto& wait : waits)
+                        wait.get();
+                    step.begin = Profiler::now();
+                    run();
+                    step.end = Profiler::now();
+                }).share();
+    return steps.size() - 1;
+}
+
+Startup::StepId Startup::begin(std::string name) {
+    auto& step = steps.emplace_back();
+    step.name = std::move(name);
+    step.begin = Profiler::now();
+    return steps.size() - 1;
+}
+
+void Startup::end(StepId step) {
+    steps[step].end = Profiler::now();
+}
+
+void Startup::wait(StepId step) {
+    if (steps[step].done.valid())
+        steps[step].done.get();
+}
+
+bool Startup::write_trace(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file)
+        return false;
+    nlohmann::json events = nlohmann::json::array();
+    for (auto& step : steps) {
+        // Failed or still running
+        if (step.end == 0)
+            continue;
+        events.push_back({{"name", step.name},
+                          {"ph", "X"},
+                          {"pid", 1},
+                          {"tid", step.thread},
+                          {"ts", step.begin * 1e-3},
+                          {"dur", (step.end - step.begin) * 1e-3}});
+    }
+    file << nlohmann::json{{"traceEvents", events},
+                           {"displayTimeUnit", "ms"}};
+    return bool(file);
+}
@@ -0,0 +1,43 @@
+#ifndef STARTUP_H_
+#define STARTUP_H_
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+// Startup as a graph of steps. Steps that need no engine state start right
+// away on worker threads once their dependencies are done, while the main
+// thread goes on with the steps that must run on it (window, Filament,
+// bindings), marked with begin and end. Every step is timed on the
+// profiler's clock and written out in the profiler's trace format.
+struct Startup {
+    using StepId = size_t;
+
+    struct Step {
+        std::string name;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        // 0 on the main thread
+        uint32_t thread = 0;
+        std::shared_future<void> done;
+    };
+
+    ~Startup();
+
+    StepId async(std::string name, std::vector<StepId> dependencies,
+                 std::function<void()> run);
+    // Main thread steps, waiting for dependencies is up to the caller
+    StepId begin(std::string name);
+    void end(StepId step);
+    // Rethrows what the step threw
+    void wait(StepId step);
+
+    bool write_trace(const std::string& path) const;
+
+    std::deque<Step> steps;
+    uint32_t workers = 0;
+};
+
+#endif // STARTUP_H_
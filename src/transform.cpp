@@ -1,14 +1,15 @@
 #include "transform.h"
 #include "graphics.h"
+#include "profiler.h"
 #include "scripting.h"
 
 void Transform::propagate_transforms(entt::registry& registry, Graphics& graphics) {
+    PROFILE_ZONE("Transform::propagate_transforms");
     auto view = registry.view<Transform, Renderable>();
     auto& transform_manager = graphics.engine->getTransformManager();
     for(auto [entity, transform, renderable] : view.each()) {
         auto transform_instance = transform_manager.getInstance(renderable.entity);
-        transform_manager.setTransform(transform_instance, Mat4f::scaling(transform.scale)
-                * Mat4f(transform.rotation) * Mat4f::translation(transform.position));
+        transform_manager.setTransform(transform_instance, transform.matrix());
     }
 }
 
@@ -1,3 +1,5 @@
+#ifndef TRANSFORM_H_
+#define TRANSFORM_H_
 #include "primitives.h"
 #include <entt/entt.hpp>
 
@@ -9,6 +11,13 @@ struct Transform {
     Vec3f scale = { 1.0 };
     Quatf rotation;
 
+    Mat4f matrix() const {
+        return Mat4f::scaling(scale) * Mat4f(rotation) *
+               Mat4f::translation(position);
+    }
+
     static void propagate_transforms(entt::registry& registry, Graphics& graphics);
     static void bind(Scripting& scripting);
 };
+
+#endif // TRANSFORM_H_
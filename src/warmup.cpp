@@ -0,0 +1,202 @@
+#include "warmup.h"
+#include "filament/LightManager.h"
+#include "filament/RenderTarget.h"
+#include "filament/Texture.h"
+#include "animation_import.h"
+#include "profiler.h"
+
+#include <filesystem>
+#include <fstream>
+#undef assert_invariant
+#include <nlohmann/json.hpp>
+
+Warmup::Warmup(Graphics& _graphics, AssetLibrary& _assets)
+    : graphics(_graphics), assets(_assets) {
+    auto& engine = *graphics.engine;
+    const uint32_t size = 64;
+    scene = engine.createScene();
+    view = engine.createView();
+    view->setScene(scene);
+    view->setViewport({0, 0, size, size});
+    color = filament::Texture::Builder()
+                .width(size)
+                .height(size)
+                .levels(1)
+                .usage(filament::Texture::Usage::COLOR_ATTACHMENT |
+                       filament::Texture::Usage::SAMPLEABLE)
+                .format(filament::Texture::InternalFormat::RGBA8)
+                .build(engine);
+    depth = filament::Texture::Builder()
+                .width(size)
+                .height(size)
+                .levels(1)
+                .usage(filament::Texture::Usage::DEPTH_ATTACHMENT)
+                .format(filament::Texture::InternalFormat::DEPTH24)
+                .build(engine);
+    target = filament::RenderTarget::Builder()
+                 .texture(filament::RenderTarget::AttachmentPoint::COLOR, color)
+                 .texture(filament::RenderTarget::AttachmentPoint::DEPTH, depth)
+                 .build(engine);
+    view->setRenderTarget(target);
+    camera = engine.createCamera(utils::EntityManager::get().create());
+    camera->setProjection(45.0f, 1.0f, 0.1f, 100.0f);
+    camera->lookAt({0, 0, 5}, {0, 0, 0}, {0, 1, 0});
+    view->setCamera(camera);
+    light = utils::EntityManager::get().create();
+    filament::LightManager::Builder(filament::LightManager::Type::SUN)
+        .direction({0.6, -1.0, -0.8})
+        .castShadows(true)
+        .build(engine, light);
+    scene->addEntity(light);
+}
+
+Warmup::~Warmup() {
+    auto& engine = *graphics.engine;
+    for (auto& renderable : renderables) {
+        engine.destroy(renderable.entity);
+        utils::EntityManager::get().destroy(renderable.entity);
+        renderable.model->material->release(engine, renderable.instance);
+    }
+    engine.destroy(light);
+    utils::EntityManager::get().destroy(light);
+    auto camera_entity = camera->getEntity();
+    engine.destroyCameraComponent(camera_entity);
+    utils::EntityManager::get().destroy(camera_entity);
+    engine.destroy(view);
+    engine.destroy(scene);
+    engine.destroy(target);
+    engine.destroy(color);
+    engine.destroy(depth);
+}
+
+void Warmup::load_manifest(const std::string& path) {
+    std::ifstream file(path);
+    if (!file)
+        return;
+    auto json = nlohmann::json::parse(file, nullptr, false);
+    if (json.is_discarded())
+        return;
+    auto add = [&](const char* key, Item::Kind kind) {
+        for (auto& name : json.value(key, nlohmann::json::array())) {
+            Item item{kind, name.get<std::string>()};
+            if (std::find_if(items.begin(), items.end(), [&](auto& i) {
+                    return i.kind == item.kind && i.name == item.name;
+                }) == items.end())
+                items.push_back(item);
+        }
+    };
+    add("shaders", Item::SHADER);
+    add("materials", Item::MATERIAL);
+    add("models", Item::MODEL);
+    // Shaders compile first, models draw last once their materials exist
+    std::stable_sort(items.begin() + done, items.end(),
+                     [](auto& a, auto& b) { return a.kind < b.kind; });
+}
+
+bool Warmup::step() {
+    if (done == items.size())
+        return false;
+    PROFILE_ZONE("Warmup::step");
+    auto& item = items[done];
+    current = item.name;
+    switch (item.kind) {
+    case Item::SHADER:
+        shaders.push_back(assets.shaders[item.name]);
+        break;
+    case Item::MATERIAL:
+        materials.push_back(assets.materials[item.name]);
+        break;
+    case Item::MODEL: {
+        auto& renderable =
+            renderables.emplace_back(graphics, assets.models[item.name]);
+        graphics.scene->remove(renderable.entity);
+        scene->addEntity(renderable.entity);
+        auto& renderable_manager = graphics.engine->getRenderableManager();
+        auto instance = renderable_manager.getInstance(renderable.entity);
+        renderable_manager.setCastShadows(instance, true);
+        renderable_manager.setReceiveShadows(instance, true);
+
+        filament::View::FogOptions fog;
+        fog.enabled = true;
+        view->setFogOptions(fog);
+        view->setShadowingEnabled(true);
+        graphics.renderer->renderStandaloneView(view);
+        fog.enabled = false;
+        view->setFogOptions(fog);
+        view->setShadowingEnabled(false);
+        graphics.renderer->renderStandaloneView(view);
+        break;
+    }
+    }
+    ++done;
+    return true;
+}
+
+float Warmup::progress() const {
+    return items.empty() ? 1.0f : float(done) / items.size();
+}
+
+void Warmup::prefetch(const std::vector<std::string>& manifests) {
+    PROFILE_ZONE("Warmup::prefetch");
+    AssetArchive archive;
+    archive.open("assets.pak");
+    volatile char sink = 0;
+    auto touch = [&](const std::string& path) {
+        auto data = archive.read(path);
+        // Mapped entries are only paged in when read
+        for (size_t i = 0; i < data.bytes.size(); i += 4096)
+            sink = sink + data.bytes[i];
+        return data;
+    };
+    // Skeletons and clips load from their descriptor's cached import
+    auto touch_import = [&](const std::string& path) {
+        auto descriptor = touch(path);
+        auto json = nlohmann::json::parse(descriptor.bytes.begin(), descriptor.bytes.end(),
+                                          nullptr, false);
+        if (!json.is_object() || !json.contains("source") || !json["source"].is_string())
+            return;
+        auto source = touch(json["source"].get<std::string>());
+        if (source)
+            touch(import_cache_path(descriptor.bytes, source.bytes));
+    };
+    for (auto& path : manifests) {
+        std::ifstream file(path);
+        if (!file)
+            continue;
+        auto json = nlohmann::json::parse(file, nullptr, false);
+        if (json.is_discarded())
+            continue;
+        for (auto& name : json.value("shaders", nlohmann::json::array()))
+            touch("shaders/" + name.get<std::string>() + ".filamat");
+        for (auto& name : json.value("materials", nlohmann::json::array()))
+            touch("materials/" + name.get<std::string>() + ".json");
+        for (auto& name : json.value("models", nlohmann::json::array())) {
+            auto data = touch("models/" + name.get<std::string>() + ".json");
+            auto model = nlohmann::json::parse(data.bytes.begin(), data.bytes.end(),
+                                               nullptr, false);
+            if (model.is_discarded())
+                continue;
+            touch("meshes/" + model.value("mesh", "") + ".glb");
+            touch("materials/" + model.value("material", "") + ".json");
+            touch_import("skeletons/" + model.value("skeleton", "") + ".json");
+            for (auto& animation : model.value("animations", nlohmann::json::array()))
+                touch_import("animations/" + animation.get<std::string>() + ".json");
+        }
+    }
+}
+
+void Warmup::save_manifest(AssetLibrary& assets, const std::string& path) {
+    auto names = [](auto& library) {
+        auto array = nlohmann::json::array();
+        for (auto& slot : library.slots)
+            if (slot.asset)
+                array.push_back(asset_name(slot.id));
+        return array;
+    };
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    std::ofstream file(path);
+    file << nlohmann::json{{"shaders", names(assets.shaders)},
+                           {"materials", names(assets.materials)},
+                           {"models", names(assets.models)}}
+                .dump(4);
+}
@@ -0,0 +1,54 @@
+#ifndef WARMUP_H_
+#define WARMUP_H_
+#include <string>
+#include <vector>
+
+#include "asset_library.h"
+#include "graphics.h"
+#include <utils/Entity.h>
+
+// Loads the assets listed in manifests and draws every model once in a
+// hidden scene, with and without fog and shadows, so that Filament builds
+// the shader variants before gameplay instead of on first sight. Items are
+// stepped one per frame on the main thread, which owns the engine; the
+// compiles they trigger run on Filament's driver thread.
+struct Warmup {
+    struct Item {
+        enum Kind { SHADER, MATERIAL, MODEL } kind;
+        std::string name;
+    };
+
+    Warmup(Graphics& graphics, AssetLibrary& assets);
+    ~Warmup();
+
+    void load_manifest(const std::string& path);
+    // Handles one item, returns false once everything is done
+    bool step();
+    float progress() const;
+
+    // Records what was loaded this session so the next one warms it up too
+    static void save_manifest(AssetLibrary& assets, const std::string& path);
+    // Reads the files behind the manifests' assets without an engine, so it
+    // can run while Filament starts and the loads later hit the page cache
+    static void prefetch(const std::vector<std::string>& manifests);
+
+    Graphics& graphics;
+    AssetLibrary& assets;
+    std::vector<Item> items;
+    size_t done = 0;
+    std::string current;
+
+    std::vector<ShaderHandle> shaders;
+    std::vector<MaterialHandle> materials;
+    std::vector<Renderable> renderables;
+
+    filament::Scene* scene;
+    filament::View* view;
+    filament::Camera* camera;
+    filament::Texture* color;
+    filament::Texture* depth;
+    filament::RenderTarget* target;
+    utils::Entity light;
+};
+
+#endif // WARMUP_H_
@@ -0,0 +1,88 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+// Set on the pool's own threads, so nested jobs run inline instead of
+// waiting on a pool they are part of
+static thread_local bool in_worker = false;
+
+WorkerPool& WorkerPool::get() {
+    static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+WorkerPool::WorkerPool(size_t thread_count) {
+    for (size_t i = 0; i < thread_count; i++)
+        threads.emplace_back([this] { work(); });
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void WorkerPool::run(size_t _count, const std::function<void(size_t)>& _task) {
+    if (threads.empty() || _count <= 1 || in_worker) {
+        for (size_t i = 0; i < _count; i++)
+            _task(i);
+        return;
+    }
+    std::lock_guard run_lock(run_mutex);
+    std::unique_lock lock(mutex);
+    // A worker that woke late for the previous job may still be leaving it
+    done.wait(lock, [this] { return busy == 0; });
+    task = &_task;
+    count = _count;
+    next = 0;
+    error = nullptr;
+    ++generation;
+    lock.unlock();
+    wake.notify_all();
+    drain(_task, _count);
+    lock.lock();
+    // Every task is claimed once drain returns, wait for the ones in flight
+    done.wait(lock, [this] { return busy == 0; });
+    task = nullptr;
+    if (error)
+        std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+void WorkerPool::drain(const std::function<void(size_t)>& job, size_t job_count) {
+    for (size_t i; (i = next++) < job_count;) {
+        try {
+            job(i);
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+}
+
+void WorkerPool::work() {
+    in_worker = true;
+    uint64_t seen = 0;
+    std::unique_lock lock(mutex);
+    while (true) {
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        if (!task)
+            continue;
+        auto& job = *task;
+        auto job_count = count;
+        ++busy;
+        lock.unlock();
+        drain(job, job_count);
+        lock.lock();
+        if (--busy == 0)
+            done.notify_all();
+    }
+}
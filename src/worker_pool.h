@@ -0,0 +1,54 @@
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads started once and reused for every fork-join job, so per-frame
+// work neither pays for thread creation nor leaves a profiler buffer behind
+// for every thread it ever used. One job runs at a time; a job started from
+// inside another one runs inline on the calling worker.
+struct WorkerPool {
+    // Shared by the engine's systems, one thread per core besides the caller
+    static WorkerPool& get();
+
+    explicit WorkerPool(size_t thread_count);
+    WorkerPool(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Workers plus the calling thread
+    size_t concurrency() const { return threads.size() + 1; }
+    // Calls task(i) for every i below count, spread over the workers and the
+    // calling thread, and returns once all of them are done. The first
+    // exception a task throws is rethrown here.
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+  private:
+    void work();
+    // Claims and runs tasks of the current job until none is left
+    void drain(const std::function<void(size_t)>& job, size_t job_count);
+
+    std::vector<std::thread> threads;
+    // Serializes callers, the pool runs one job at a time
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)>* task = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next = 0;
+    uint64_t generation = 0;
+    size_t busy = 0;
+    std::exception_ptr error;
+    bool stopping = false;
+};
+
+#endif // WORKER_POOL_H_
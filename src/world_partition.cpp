@@ -0,0 +1,185 @@
+#include "world_partition.h"
+#include "graphics.h"
+#include "profiler.h"
+#include "scripting.h"
+#include "transform.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+#undef assert_invariant
+#include <nlohmann/json.hpp>
+
+static int64_t cell_key(int32_t x, int32_t z) {
+    return int64_t(uint64_t(uint32_t(x)) << 32 | uint32_t(z));
+}
+
+WorldPartition::WorldPartition(entt::registry& _registry, Graphics& _graphics,
+                               AssetLibrary& _assets)
+    : registry(_registry), graphics(_graphics), assets(_assets) {}
+
+void WorldPartition::open(const std::string& directory) {
+    close();
+    if (!std::filesystem::is_directory(directory)) {
+        LOG_ERROR(logger(LogChannel::WORLD), "World directory does not exist path={}", directory);
+        return;
+    }
+    // Cells are only found again with the size they were split with
+    std::ifstream header(directory + "/world.json");
+    auto json = nlohmann::json::parse(header, nullptr, false);
+    if (!json.is_object() || !json.contains("cell_size") || !json["cell_size"].is_number() ||
+        json["cell_size"].get<float>() <= 0) {
+        LOG_ERROR(logger(LogChannel::WORLD), "Missing or malformed world header path={}/world.json", directory);
+        return;
+    }
+    cell_size = json["cell_size"].get<float>();
+    for (auto& file : std::filesystem::directory_iterator(directory)) {
+        int32_t x, z;
+        if (file.path().extension() != ".snap" ||
+            std::sscanf(file.path().stem().c_str(), "%d_%d", &x, &z) != 2)
+            continue;
+        auto& cell = cells[cell_key(x, z)];
+        cell.x = x;
+        cell.z = z;
+        cell.path = file.path().string();
+    }
+}
+
+void WorldPartition::destroy_entities(Cell& cell) {
+    // Scripts, snapshot.restore or Snapshot::clear may have destroyed some
+    // already; a recycled id carries a new version and fails this check too
+    std::erase_if(cell.entities, [&](auto entity) { return !registry.valid(entity); });
+    Snapshot::destroy(registry, graphics, cell.entities);
+    cell.entities.clear();
+}
+
+void WorldPartition::close() {
+    for (auto& [key, cell] : cells) {
+        if (cell.state == State::LOADING)
+            cell.loading.wait();
+        if (cell.state == State::ACTIVE)
+            destroy_entities(cell);
+    }
+    cells.clear();
+}
+
+void WorldPartition::update(Vec3f camera) {
+    PROFILE_ZONE("WorldPartition::update");
+    std::vector<std::pair<float, Cell*>> activate, deactivate;
+    for (auto& [key, cell] : cells) {
+        float dx = (cell.x + 0.5f) * cell_size - camera.x;
+        float dz = (cell.z + 0.5f) * cell_size - camera.z;
+        float distance = std::sqrt(dx * dx + dz * dz);
+        bool near = distance < load_radius;
+        bool far = distance > unload_radius;
+
+        if (cell.state == State::LOADING &&
+            cell.loading.wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready) {
+            cell.failed = !cell.loading.get();
+            cell.state = cell.failed ? State::UNLOADED : State::LOADED;
+        }
+        switch (cell.state) {
+        case State::UNLOADED:
+            if (near && !cell.failed) {
+                cell.state = State::LOADING;
+                // Parsing touches neither the registry nor the asset library
+                cell.loading = std::async(std::launch::async, [cell = &cell]() {
+                    std::ifstream file(cell->path, std::ios::binary);
+                    return file && cell->snapshot.read(file);
+                });
+            }
+            break;
+        case State::LOADED:
+            if (near)
+                activate.emplace_back(distance, &cell);
+            else if (far) {
+                cell.snapshot = {};
+                cell.state = State::UNLOADED;
+            }
+            break;
+        case State::ACTIVE:
+            if (far)
+                deactivate.emplace_back(-distance, &cell);
+            break;
+        case State::LOADING:
+            break;
+        }
+    }
+
+    // Farthest cells go first, then the nearest come in, within the budget
+    std::sort(deactivate.begin(), deactivate.end());
+    std::sort(activate.begin(), activate.end());
+    auto deadline = std::chrono::high_resolution_clock::now() +
+                    std::chrono::duration<float>(activation_budget);
+    bool worked = false;
+    auto in_budget = [&]() {
+        // At least one cell per frame, so a slow cell cannot stall streaming
+        return !worked || std::chrono::high_resolution_clock::now() < deadline;
+    };
+    for (auto [distance, cell] : deactivate) {
+        if (!in_budget())
+            return;
+        PROFILE_ZONE("WorldPartition::deactivate");
+        destroy_entities(*cell);
+        cell->snapshot = {};
+        cell->state = State::UNLOADED;
+        worked = true;
+    }
+    for (auto [distance, cell] : activate) {
+        if (!in_budget())
+            return;
+        PROFILE_ZONE("WorldPartition::activate");
+        cell->entities = cell->snapshot.instantiate(registry, graphics, assets);
+        cell->state = State::ACTIVE;
+        worked = true;
+    }
+}
+
+void WorldPartition::build(entt::registry& registry,
+                           const std::string& directory, float cell_size) {
+    std::unordered_map<int64_t, std::unordered_set<entt::entity>> members;
+    std::unordered_map<int64_t, std::pair<int32_t, int32_t>> coordinates;
+    for (auto [entity, transform] : registry.view<Transform>().each()) {
+        int32_t x = std::floor(transform.position.x / cell_size);
+        int32_t z = std::floor(transform.position.z / cell_size);
+        members[cell_key(x, z)].insert(entity);
+        coordinates[cell_key(x, z)] = {x, z};
+    }
+    std::filesystem::create_directories(directory);
+    std::ofstream(directory + "/world.json") << nlohmann::json{{"cell_size", cell_size}}.dump(4);
+    for (auto& [key, entities] : members) {
+        auto [x, z] = coordinates[key];
+        std::ofstream file(directory + "/" + std::to_string(x) + "_" +
+                               std::to_string(z) + ".snap",
+                           std::ios::binary);
+        Snapshot::capture(registry, [&](auto entity) {
+            return entities.count(entity) > 0;
+        }).write(file);
+    }
+}
+
+void WorldPartition::bind(Scripting& scripting) {
+    auto& lua = scripting.lua;
+    lua["world"] = lua.create_table();
+    lua["world"]["open"] = [this](const std::string& directory) { open(directory); };
+    lua["world"]["close"] = [this]() { close(); };
+    lua["world"]["build"] = [this](const std::string& directory, float size) { build(registry, directory, size); };
+    lua["world"]["set_radius"] = [this](float load, float unload) {
+        if (unload < load)
+            throw sol::error("Unload radius must not be smaller than load radius");
+        load_radius = load;
+        unload_radius = unload;
+    };
+    lua["world"]["set_budget"] = [this](float seconds) { activation_budget = seconds; };
+    lua["world"]["active_cells"] = [this]() {
+        return std::count_if(cells.begin(), cells.end(), [](auto& cell) {
+            return cell.second.state == State::ACTIVE;
+        });
+    };
+}
@@ -0,0 +1,66 @@
+#ifndef WORLD_PARTITION_H_
+#define WORLD_PARTITION_H_
+#include <cstdint>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <entt/entt.hpp>
+
+#include "primitives.h"
+#include "snapshot.h"
+
+struct AssetLibrary;
+struct Graphics;
+struct Scripting;
+
+// Streams a world split into square cells on the XZ plane, each stored as a
+// snapshot named <x>_<z>.snap in the world directory next to world.json,
+// which records the cell size the world was built with. Cells within
+// load_radius of the camera are read on a worker thread and then activated
+// on the main thread; cells beyond unload_radius are destroyed, which drops
+// their asset handles so the asset library can evict them.
+struct WorldPartition {
+    enum class State { UNLOADED, LOADING, LOADED, ACTIVE };
+
+    struct Cell {
+        int32_t x, z;
+        std::string path;
+        State state = State::UNLOADED;
+        bool failed = false;
+        std::future<bool> loading;
+        Snapshot snapshot;
+        std::vector<entt::entity> entities;
+    };
+
+    WorldPartition(entt::registry& registry, Graphics& graphics,
+                   AssetLibrary& assets);
+
+    // Replaces the current world, destroying its active cells
+    void open(const std::string& directory);
+    void close();
+    void update(Vec3f camera);
+    // Splits the registry's placed entities into cell snapshots
+    static void build(entt::registry& registry, const std::string& directory,
+                      float cell_size);
+
+    void bind(Scripting& scripting);
+
+    // Destroys whichever of the cell's entities still exist
+    void destroy_entities(Cell& cell);
+
+    entt::registry& registry;
+    Graphics& graphics;
+    AssetLibrary& assets;
+
+    // Read from the world's world.json on open
+    float cell_size = 64;
+    float load_radius = 128;
+    // Larger than load_radius, so cells on the edge don't flip every frame
+    float unload_radius = 192;
+    // Seconds per frame spent activating and deactivating cells
+    float activation_budget = 0.002f;
+    std::unordered_map<int64_t, Cell> cells;
+};
+
+#endif // WORLD_PARTITION_H_